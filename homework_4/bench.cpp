@@ -0,0 +1,320 @@
+// Synthetic registry benchmark for CStudyDept. Prints one JSON object per line, so results of two builds can be
+// compared with any line-oriented tool:
+//
+//   homework_4_bench --sizes=1000,100000,1000000 --zipf=1.1 --duplicates=0.05 --queries=200 --seed=42
+//
+// Every size gets a fresh registry: add throughput, search latency per filter / sort shape before and after
+// freeze(), suggest latency, then delete throughput on half of the students.
+
+#include <random>
+#include <numeric>
+#include <chrono>
+#include "main.cpp"
+
+struct SBenchConfig {
+    std::vector<size_t> m_Sizes{1000, 10000, 100000};
+    // exponent of the name distribution, 0 is uniform
+    double m_Zipf = 1.1;
+    // share of generated rows repeating an earlier row exactly, the department rejects them
+    double m_Duplicates = 0.05;
+    size_t m_Queries = 200;
+    // a query shape stops early once it has run this long
+    double m_Budget = 2.0;
+    // result cache entries; 0 measures the query paths themselves
+    size_t m_Cache = 0;
+    uint64_t m_Seed = 42;
+};
+
+// samples ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s
+class CZipf {
+public:
+    CZipf(size_t n, double s) : m_Cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            m_Cdf[i] = sum += 1 / std::pow(static_cast<double>(i + 1), s);
+        for (double &p : m_Cdf)
+            p /= sum;
+    }
+
+    size_t operator()(std::mt19937_64 &rng) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::min<size_t>(std::lower_bound(m_Cdf.begin(), m_Cdf.end(), u) - m_Cdf.begin(), m_Cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> m_Cdf;
+};
+
+struct SRow {
+    std::string m_Name;
+    int m_Y, m_M, m_D;
+    int m_Enrolled;
+
+    CDate born() const {
+        return CDate(m_Y, m_M, m_D);
+    }
+};
+
+// registry rows with Zipf-distributed first and last names drawn from pools of pronounceable words
+class CRegistryGenerator {
+public:
+    CRegistryGenerator(const SBenchConfig &cfg, std::mt19937_64 &rng)
+            : m_Cfg(cfg), m_Rng(rng), m_First(word(2000, 2)), m_Last(word(50000, 3)),
+              m_FirstRank(m_First.size(), cfg.m_Zipf), m_LastRank(m_Last.size(), cfg.m_Zipf) {}
+
+    std::vector<SRow> generate(size_t n) {
+        std::vector<SRow> rows;
+        rows.reserve(n);
+        std::bernoulli_distribution duplicate(m_Cfg.m_Duplicates), middle(0.1);
+        for (size_t i = 0; i < n; ++i) {
+            if (!rows.empty() && duplicate(m_Rng)) {
+                rows.push_back(rows[std::uniform_int_distribution<size_t>(0, rows.size() - 1)(m_Rng)]);
+                continue;
+            }
+            std::string name = m_First[m_FirstRank(m_Rng)];
+            if (middle(m_Rng))
+                name += ' ' + m_First[m_FirstRank(m_Rng)];
+            name += ' ' + m_Last[m_LastRank(m_Rng)];
+            int year = std::uniform_int_distribution<int>(1950, 2005)(m_Rng);
+            rows.push_back(SRow{std::move(name), year, std::uniform_int_distribution<int>(1, 12)(m_Rng),
+                                std::uniform_int_distribution<int>(1, 28)(m_Rng),
+                                year + std::uniform_int_distribution<int>(18, 25)(m_Rng)});
+        }
+        return rows;
+    }
+
+private:
+    // `count` distinct capitalised words of `syllables` syllables, most frequent first
+    static std::vector<std::string> word(size_t count, size_t syllables) {
+        static const char *const PARTS[] = {"ba", "ko", "ri", "na", "te", "lu", "mi", "so", "da", "ve", "ja", "pe",
+                                            "ra", "ni", "to", "ma", "le", "ki", "zu", "ho", "sa", "di", "vo", "an"};
+        constexpr size_t PART_COUNT = std::size(PARTS);
+        std::vector<std::string> res;
+        for (size_t i = 0; i < count; ++i) {
+            std::string w;
+            for (size_t k = 0, rest = i; k < syllables || rest; ++k, rest /= PART_COUNT)
+                w += PARTS[rest % PART_COUNT];
+            w[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(w[0])));
+            res.push_back(std::move(w));
+        }
+        return res;
+    }
+
+    const SBenchConfig &m_Cfg;
+    std::mt19937_64 &m_Rng;
+    std::vector<std::string> m_First;
+    std::vector<std::string> m_Last;
+    CZipf m_FirstRank;
+    CZipf m_LastRank;
+};
+
+// one JSON object on one line, flushed when destroyed
+class CJsonLine {
+public:
+    explicit CJsonLine(const std::string &bench) {
+        add("bench", bench);
+    }
+
+    ~CJsonLine() {
+        std::cout << m_Text << "}\n" << std::flush;
+    }
+
+    CJsonLine &add(const std::string &key, const std::string &value) {
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\')
+                quoted += '\\';
+            quoted += c;
+        }
+        return raw(key, quoted + '"');
+    }
+
+    CJsonLine &add(const std::string &key, const char *value) {
+        return add(key, std::string(value));
+    }
+
+    CJsonLine &add(const std::string &key, bool value) {
+        return raw(key, value ? "true" : "false");
+    }
+
+    template <typename T_>
+    CJsonLine &add(const std::string &key, T_ value) requires std::is_arithmetic_v<T_> {
+        std::ostringstream os;
+        os << std::setprecision(6) << value;
+        return raw(key, os.str());
+    }
+
+private:
+    CJsonLine &raw(const std::string &key, const std::string &value) {
+        m_Text += (m_Text.size() > 1 ? ",\"" : "\"") + key + "\":" + value;
+        return *this;
+    }
+
+    std::string m_Text = "{";
+};
+
+using TClock = std::chrono::steady_clock;
+
+static double secondsSince(TClock::time_point start) {
+    return std::chrono::duration<double>(TClock::now() - start).count();
+}
+
+// runs `query` up to the configured number of times and reports its latency distribution
+template <typename F_>
+static void measure(const SBenchConfig &cfg, const std::string &bench, const std::string &shape, size_t size,
+                    bool frozen, F_ query) {
+    CLatencyHistogram latency;
+    size_t rows = 0;
+    auto start = TClock::now();
+    while (latency.count() < cfg.m_Queries && (latency.count() == 0 || secondsSince(start) < cfg.m_Budget)) {
+        auto begin = TClock::now();
+        rows += query();
+        auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(TClock::now() - begin).count());
+        latency.add(CLatencyHistogram::bucketOf(ns), 1, ns);
+    }
+    CJsonLine(bench).add("shape", shape).add("size", size).add("frozen", frozen).add("queries", latency.count())
+            .add("rows", static_cast<double>(rows) / latency.count()).add("mean_ns", latency.mean())
+            .add("p50_ns", latency.percentile(0.5)).add("p90_ns", latency.percentile(0.9))
+            .add("p99_ns", latency.percentile(0.99)).add("max_ns", latency.percentile(1));
+}
+
+static void searchShapes(const SBenchConfig &cfg, const CStudyDept &dept, const std::vector<SRow> &rows,
+                         std::mt19937_64 &rng, bool frozen) {
+    auto pick = [&]() -> const SRow & {
+        return rows[std::uniform_int_distribution<size_t>(0, rows.size() - 1)(rng)];
+    };
+    auto run = [&](const std::string &shape, auto makeQuery) {
+        measure(cfg, "search", shape, rows.size(), frozen, [&] {
+            auto [flt, sortOpt] = makeQuery(pick());
+            return dept.search(flt, sortOpt).size();
+        });
+    };
+
+    run("name", [](const SRow &row) {
+        return std::pair(CFilter().name(row.m_Name), CSort());
+    });
+    run("three-names/by-name", [&](const SRow &row) {
+        return std::pair(CFilter().name(row.m_Name).name(pick().m_Name).name(pick().m_Name),
+                         CSort().addKey(ESortKey::NAME, true));
+    });
+    run("enroll-range", [](const SRow &row) {
+        return std::pair(CFilter().enrolledAfter(row.m_Enrolled - 1).enrolledBefore(row.m_Enrolled + 2), CSort());
+    });
+    run("enroll-range/by-name", [](const SRow &row) {
+        return std::pair(CFilter().enrolledAfter(row.m_Enrolled - 1).enrolledBefore(row.m_Enrolled + 2),
+                         CSort().addKey(ESortKey::NAME, true));
+    });
+    run("born-year/by-born", [](const SRow &row) {
+        return std::pair(CFilter().bornAfter(CDate(row.m_Y - 1, 12, 31)).bornBefore(CDate(row.m_Y + 1, 1, 1)),
+                         CSort().addKey(ESortKey::BIRTH_DATE, true));
+    });
+    run("born-year+name/by-enroll", [](const SRow &row) {
+        return std::pair(CFilter().bornAfter(CDate(row.m_Y - 1, 12, 31)).bornBefore(CDate(row.m_Y + 1, 1, 1))
+                                 .name(row.m_Name), CSort().addKey(ESortKey::ENROLL_YEAR, false));
+    });
+    run("all/by-enroll-name", [](const SRow &) {
+        return std::pair(CFilter(), CSort().addKey(ESortKey::ENROLL_YEAR, false).addKey(ESortKey::NAME, true));
+    });
+}
+
+static void suggestShapes(const SBenchConfig &cfg, const CStudyDept &dept, const std::vector<SRow> &rows,
+                          std::mt19937_64 &rng) {
+    auto token = [&] {
+        const std::string &name = rows[std::uniform_int_distribution<size_t>(0, rows.size() - 1)(rng)].m_Name;
+        return name.substr(name.rfind(' ') + 1);
+    };
+    measure(cfg, "suggest", "last-name", rows.size(), false, [&] { return dept.suggest(token()).size(); });
+    measure(cfg, "suggest", "last-name/top10", rows.size(), false, [&] { return dept.suggest(token(), 10).size(); });
+    measure(cfg, "suggest", "phonetic", rows.size(), false, [&] { return dept.suggestPhonetic(token()).size(); });
+}
+
+static void benchSize(const SBenchConfig &cfg, size_t size, std::mt19937_64 &rng) {
+    auto rows = CRegistryGenerator(cfg, rng).generate(size);
+    CStudyDept dept(cfg.m_Cache);
+
+    auto start = TClock::now();
+    size_t accepted = 0;
+    for (const auto &row : rows)
+        accepted += dept.emplaceStudent(row.m_Name, row.born(), row.m_Enrolled);
+    double seconds = secondsSince(start);
+    CJsonLine("add").add("size", size).add("accepted", accepted).add("seconds", seconds)
+            .add("ops_per_sec", size / seconds);
+
+    searchShapes(cfg, dept, rows, rng, false);
+    suggestShapes(cfg, dept, rows, rng);
+    start = TClock::now();
+    dept.freeze();
+    CJsonLine("freeze").add("size", size).add("seconds", secondsSince(start));
+    searchShapes(cfg, dept, rows, rng, true);
+
+    std::vector<size_t> order(rows.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    order.resize(order.size() / 2);
+    start = TClock::now();
+    size_t removed = 0;
+    for (size_t i : order)
+        removed += dept.delStudent(rows[i].m_Name, rows[i].born(), rows[i].m_Enrolled);
+    seconds = secondsSince(start);
+    CJsonLine("delete").add("size", size).add("ops", order.size()).add("removed", removed).add("seconds", seconds)
+            .add("ops_per_sec", order.size() / seconds);
+}
+
+static SBenchConfig parseArgs(int argc, char *argv[]) {
+    SBenchConfig cfg;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (!arg.starts_with("--") || eq == std::string::npos)
+            throw std::invalid_argument("Expected --option=value, got " + arg + ".\n");
+        std::string key = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+        if (key == "sizes") {
+            cfg.m_Sizes.clear();
+            std::istringstream is(value);
+            for (std::string part; std::getline(is, part, ',');)
+                cfg.m_Sizes.push_back(std::stoull(part));
+        } else if (key == "zipf")
+            cfg.m_Zipf = std::stod(value);
+        else if (key == "duplicates")
+            cfg.m_Duplicates = std::clamp(std::stod(value), 0.0, 1.0);
+        else if (key == "queries")
+            cfg.m_Queries = std::max<size_t>(1, std::stoull(value));
+        else if (key == "budget")
+            cfg.m_Budget = std::stod(value);
+        else if (key == "cache")
+            cfg.m_Cache = std::stoull(value);
+        else if (key == "seed")
+            cfg.m_Seed = std::stoull(value);
+        else
+            throw std::invalid_argument("Unknown option --" + key + ".\n");
+    }
+    return cfg;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        SBenchConfig cfg = parseArgs(argc, argv);
+        std::mt19937_64 rng(cfg.m_Seed);
+        {
+            CJsonLine meta("meta");
+#if defined(__VERSION__)
+            meta.add("compiler", __VERSION__);
+#endif
+#if defined(NDEBUG)
+            meta.add("asserts", false);
+#else
+            meta.add("asserts", true);
+#endif
+            meta.add("stats", STUDYDEPT_STATS != 0).add("zipf", cfg.m_Zipf).add("duplicates", cfg.m_Duplicates)
+                    .add("queries", cfg.m_Queries).add("cache", cfg.m_Cache).add("seed", cfg.m_Seed)
+                    .add("threads", std::thread::hardware_concurrency());
+        }
+        for (size_t size : cfg.m_Sizes)
+            if (size)
+                benchSize(cfg, size, rng);
+    } catch (const std::exception &e) {
+        std::cerr << e.what();
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -5,6 +5,7 @@
 #include <cstring>
 #include <cctype>
 #include <climits>
+#include <cmath>
 #include <cassert>
 #include <iostream>
 #include <iomanip>
@@ -21,6 +22,29 @@
 #include <functional>
 #include <iterator>
 #include <compare>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <stop_token>
+#include <chrono>
+#include <deque>
+#include <bit>
+#include <cstdint>
+#include <atomic>
+#include <utility>
+#include <charconv>
+#include <cerrno>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 class CDate {
 public:
@@ -50,7 +74,7 @@ enum class ESortKey {
 
 class CStudent {
 public:
-    CStudent(const std::string &name,const CDate &born,int enrolled):m_name(name) , m_born(born) , m_enrolled(enrolled) , {}
+    CStudent(const std::string &name,const CDate &born,int enrolled):m_name(name) , m_born(born) , m_enrolled(enrolled) , m_id(0) {}
 
     bool operator==(const CStudent &other) const{
         return m_name == other.m_name && m_born == other.m_born && m_enrolled == other.m_enrolled;
@@ -87,6 +111,9 @@ public:
 // use multiset and vector for sorted by names
 
 private:
+    friend class CStudyDept;
+    friend class CFeedSubscriber;
+
     std::string m_name;
     CDate m_born;
     int m_enrolled;
@@ -94,13 +121,307 @@ private:
 
 };
 
+// splits a name into case-folded tokens: ASCII as std::isspace / std::tolower do in the C locale, UTF-8
+// letters by the simple Unicode case folding of the subset fold() lists, plus sharp s to "ss". Not a full
+// CaseFolding table: code points outside that subset and the other full (multi-letter) foldings are left
+// as they are. The spans point into a buffer reused by the next split, so a tokenizer is
+// kept per thread and call site
+class CTokenizer {
+public:
+    std::vector<std::string_view> &split(std::string_view text) {
+        // no folding makes the UTF-8 longer, so the output fits in the input's size
+        m_Lower.resize(text.size());
+        m_Tokens.clear();
+        m_Start = NONE;
+        m_Out = 0;
+        size_t i = 0;
+#if defined(__SSE2__)
+        // 16 ASCII bytes at a time, a block with any byte >= 0x80 goes the scalar way
+        while (i + 16 <= text.size()) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + i));
+            if (_mm_movemask_epi8(v)) {
+                i = scalar(text, i, i + 16);
+                continue;
+            }
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                          _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(m_Lower.data() + m_Out),
+                             _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                         _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                                       _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1))));
+            spans(static_cast<uint32_t>(_mm_movemask_epi8(space)), 16);
+            m_Out += 16;
+            i += 16;
+        }
+#endif
+        scalar(text, i, text.size());
+        if (m_Start != NONE)
+            m_Tokens.emplace_back(m_Lower.data() + m_Start, m_Out - m_Start);
+        return m_Tokens;
+    }
+
+    // the simple (C + S) CaseFolding.txt mapping of one code point, restricted to this subset:
+    //   U+00B5, U+00C0-00DE, U+0100-024F (less U+023A, U+023E), U+0386-03AB, U+03C2, U+0400-052F, U+0531-0556,
+    //   U+10A0-10CD, U+1E00-1EFF, U+FF21-FF3A, U+10400-10427, U+104B0-104D3, U+10C80-10CB2, U+118A0-118BF,
+    //   U+16E40-16E5F, U+1E900-1E921
+    // Every other code point is returned as is: Greek Extended, Cherokee, Latin Extended-C / D, the Turkic
+    // (T) and the full (F) mappings, so U+0130 stays U+0130. The one full folding applied is sharp s (U+00DF,
+    // U+1E9E) to "ss", done by the caller. U+023A and U+023E fold to longer UTF-8 and the buffer never grows
+    static char32_t fold(char32_t c) {
+        if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+            return c + 0x20;
+        if (c == 0xB5)
+            return 0x3BC;
+        if (c >= 0x100 && c <= 0x17F) {
+            // Latin Extended-A alternates capital / small, the parity flips after the unpaired 0x138 and 0x149
+            if (c == 0x178) return 0xFF;
+            if (c == 0x17F) return 's';
+            if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149) return c;
+            if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+                return c & 1 ? c + 1 : c;
+            return c & 1 ? c : c + 1;
+        }
+        if (c >= 0x180 && c <= 0x24F)
+            return foldLatinExtB(c);
+        if (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+            return c + 0x20;
+        if (c == 0x386) return 0x3AC;
+        if (c >= 0x388 && c <= 0x38A) return c + 0x25;
+        if (c == 0x38C) return 0x3CC;
+        if (c == 0x38E || c == 0x38F) return c + 0x3F;
+        if (c == 0x3C2) return 0x3C3;
+        if (c >= 0x400 && c <= 0x40F)
+            return c + 0x50;
+        if (c >= 0x410 && c <= 0x42F)
+            return c + 0x20;
+        if ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) || (c >= 0x4D0 && c <= 0x52F))
+            return c & 1 ? c : c + 1;
+        if (c == 0x4C0) return 0x4CF;
+        if (c >= 0x4C1 && c <= 0x4CE)
+            return c & 1 ? c + 1 : c;
+        if (c >= 0x531 && c <= 0x556)
+            return c + 0x30;
+        if ((c >= 0x10A0 && c <= 0x10C5) || c == 0x10C7 || c == 0x10CD)
+            return c + 0x1C60;
+        // Latin Extended Additional pairs capital / small, apart from the few letters past 0x1E95
+        if ((c >= 0x1E00 && c <= 0x1E95) || (c >= 0x1EA0 && c <= 0x1EFF))
+            return c & 1 ? c : c + 1;
+        if (c == 0x1E9B) return 0x1E61;
+        if (c >= 0xFF21 && c <= 0xFF3A)
+            return c + 0x20;
+        if ((c >= 0x10400 && c <= 0x10427) || (c >= 0x104B0 && c <= 0x104D3))
+            return c + 0x28;
+        if (c >= 0x10C80 && c <= 0x10CB2)
+            return c + 0x40;
+        if ((c >= 0x118A0 && c <= 0x118BF) || (c >= 0x16E40 && c <= 0x16E5F))
+            return c + 0x20;
+        if (c >= 0x1E900 && c <= 0x1E921)
+            return c + 0x22;
+        return c;
+    }
+
+private:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    // Latin Extended-B: runs of capital / small pairs, the remaining capitals are looked up
+    static char32_t foldLatinExtB(char32_t c) {
+        static constexpr std::pair<char16_t, char16_t> SINGLE[] = {
+                {0x181, 0x253}, {0x182, 0x183}, {0x184, 0x185}, {0x186, 0x254}, {0x187, 0x188}, {0x189, 0x256},
+                {0x18A, 0x257}, {0x18B, 0x18C}, {0x18E, 0x1DD}, {0x18F, 0x259}, {0x190, 0x25B}, {0x191, 0x192},
+                {0x193, 0x260}, {0x194, 0x263}, {0x196, 0x269}, {0x197, 0x268}, {0x198, 0x199}, {0x19C, 0x26F},
+                {0x19D, 0x272}, {0x19F, 0x275}, {0x1A0, 0x1A1}, {0x1A2, 0x1A3}, {0x1A4, 0x1A5}, {0x1A6, 0x280},
+                {0x1A7, 0x1A8}, {0x1A9, 0x283}, {0x1AC, 0x1AD}, {0x1AE, 0x288}, {0x1AF, 0x1B0}, {0x1B1, 0x28A},
+                {0x1B2, 0x28B}, {0x1B3, 0x1B4}, {0x1B5, 0x1B6}, {0x1B7, 0x292}, {0x1B8, 0x1B9}, {0x1BC, 0x1BD},
+                {0x1C4, 0x1C6}, {0x1C5, 0x1C6}, {0x1C7, 0x1C9}, {0x1C8, 0x1C9}, {0x1CA, 0x1CC}, {0x1CB, 0x1CC},
+                {0x1F1, 0x1F3}, {0x1F2, 0x1F3}, {0x1F4, 0x1F5}, {0x1F6, 0x195}, {0x1F7, 0x1BF}, {0x220, 0x19E},
+                {0x23B, 0x23C}, {0x23D, 0x19A}, {0x241, 0x242}, {0x243, 0x180}, {0x244, 0x289}, {0x245, 0x28C}};
+        if (c >= 0x1CD && c <= 0x1DC)
+            return c & 1 ? c + 1 : c;
+        if ((c >= 0x1DE && c <= 0x1EF) || (c >= 0x1F8 && c <= 0x21F) || (c >= 0x222 && c <= 0x233)
+            || (c >= 0x246 && c <= 0x24F))
+            return c & 1 ? c : c + 1;
+        auto it = std::lower_bound(std::begin(SINGLE), std::end(SINGLE), c,
+                                   [](const auto &pair, char32_t cp) { return pair.first < cp; });
+        return it != std::end(SINGLE) && it->first == c ? it->second : c;
+    }
+
+    // well-formed sequence at `i` as (code point, length), length 0 for a stray or truncated byte
+    static std::pair<char32_t, size_t> decode(std::string_view text, size_t i) {
+        auto lead = static_cast<unsigned char>(text[i]);
+        size_t len = lead >= 0xF0 && lead <= 0xF4 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 && lead <= 0xDF ? 2 : 0;
+        if (len == 0 || i + len > text.size() || (len == 4 && lead > 0xF4))
+            return {0, 0};
+        char32_t cp = lead & (0x7F >> len);
+        for (size_t j = 1; j < len; ++j) {
+            auto cont = static_cast<unsigned char>(text[i + j]);
+            if ((cont & 0xC0) != 0x80)
+                return {0, 0};
+            cp = cp << 6 | (cont & 0x3F);
+        }
+        if ((len == 3 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) || (len == 4 && (cp < 0x10000 || cp > 0x10FFFF)))
+            return {0, 0};
+        return {cp, len};
+    }
+
+    void put(char32_t c) {
+        if (c < 0x80) {
+            m_Lower[m_Out++] = static_cast<char>(c);
+        } else if (c < 0x800) {
+            m_Lower[m_Out++] = static_cast<char>(0xC0 | c >> 6);
+            m_Lower[m_Out++] = static_cast<char>(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            m_Lower[m_Out++] = static_cast<char>(0xE0 | c >> 12);
+            m_Lower[m_Out++] = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+            m_Lower[m_Out++] = static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            m_Lower[m_Out++] = static_cast<char>(0xF0 | c >> 18);
+            m_Lower[m_Out++] = static_cast<char>(0x80 | (c >> 12 & 0x3F));
+            m_Lower[m_Out++] = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+            m_Lower[m_Out++] = static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+
+    // byte by byte up to `to`, a sequence crossing it is finished; returns where it stopped
+    size_t scalar(std::string_view text, size_t i, size_t to) {
+        while (i < to) {
+            auto ch = static_cast<unsigned char>(text[i]);
+            if (ch < 0x80 && std::isspace(ch)) {
+                if (m_Start != NONE)
+                    m_Tokens.emplace_back(m_Lower.data() + m_Start, m_Out - m_Start);
+                m_Start = NONE;
+                ++i;
+                continue;
+            }
+            if (m_Start == NONE)
+                m_Start = m_Out;
+            auto [cp, len] = ch < 0x80 ? std::pair<char32_t, size_t>{0, 0} : decode(text, i);
+            if (len == 0) {
+                m_Lower[m_Out++] = static_cast<char>(std::tolower(ch));
+                ++i;
+            } else if (cp == 0xDF || cp == 0x1E9E) {
+                // sharp s folds to two letters, still no longer than its own encoding
+                m_Lower[m_Out++] = 's';
+                m_Lower[m_Out++] = 's';
+                i += len;
+            } else {
+                put(fold(cp));
+                i += len;
+            }
+        }
+        return i;
+    }
+
+    // bit j of `space` is set for whitespace at output position m_Out + j; looks alternately for a token
+    // start and a token end
+    void spans(uint32_t space, size_t n) {
+        uint32_t all = (uint32_t(1) << n) - 1;
+        size_t pos = 0;
+        while (pos < n) {
+            uint32_t next = (m_Start == NONE ? ~space : space) & all & (~uint32_t(0) << pos);
+            if (!next)
+                return;
+            pos = std::countr_zero(next);
+            if (m_Start == NONE) {
+                m_Start = m_Out + pos;
+            } else {
+                m_Tokens.emplace_back(m_Lower.data() + m_Start, m_Out + pos - m_Start);
+                m_Start = NONE;
+            }
+        }
+    }
+
+    std::string m_Lower;
+    std::vector<std::string_view> m_Tokens;
+    size_t m_Start = NONE;
+    size_t m_Out = 0;
+};
+
+// boolean combination of filter predicates, CFilter::where compiles it into a flat program
+class CFilterExpr
+{
+public:
+    static CFilterExpr name ( const std::string & name );
+
+    static CFilterExpr bornBefore ( const CDate & date ){
+        CFilterExpr res(EOp::BORN_BEFORE);
+        res.m_Date.emplace(date);
+        return res;
+    }
+
+    static CFilterExpr bornAfter ( const CDate & date ){
+        CFilterExpr res(EOp::BORN_AFTER);
+        res.m_Date.emplace(date);
+        return res;
+    }
+
+    static CFilterExpr enrolledBefore ( int year ){
+        CFilterExpr res(EOp::ENROLLED_BEFORE);
+        res.m_Year = year;
+        return res;
+    }
+
+    static CFilterExpr enrolledAfter ( int year ){
+        CFilterExpr res(EOp::ENROLLED_AFTER);
+        res.m_Year = year;
+        return res;
+    }
+
+    friend CFilterExpr operator && ( const CFilterExpr & a, const CFilterExpr & b ){
+        return combine(EOp::AND, a, b);
+    }
+
+    friend CFilterExpr operator || ( const CFilterExpr & a, const CFilterExpr & b ){
+        return combine(EOp::OR, a, b);
+    }
+
+    friend CFilterExpr operator ! ( const CFilterExpr & a ){
+        CFilterExpr res(EOp::NOT);
+        res.m_Children.push_back(a);
+        return res;
+    }
+
+private:
+    friend class CFilter;
+
+    enum class EOp { NAME, BORN_BEFORE, BORN_AFTER, ENROLLED_BEFORE, ENROLLED_AFTER, AND, OR, NOT };
+
+    explicit CFilterExpr(EOp op) : m_Op(op) {}
+
+    bool isLeaf() const {
+        return m_Op != EOp::AND && m_Op != EOp::OR && m_Op != EOp::NOT;
+    }
+
+    static CFilterExpr combine(EOp op, const CFilterExpr &a, const CFilterExpr &b) {
+        CFilterExpr res(op);
+        for (const auto *part : {&a, &b}) {
+            if (part->m_Op == op)
+                res.m_Children.insert(res.m_Children.end(), part->m_Children.begin(), part->m_Children.end());
+            else
+                res.m_Children.push_back(*part);
+        }
+        return res;
+    }
+
+    EOp m_Op;
+    // leaves only, set once NOTs have been pushed down to them
+    bool m_Negate = false;
+    std::vector<std::string> m_Tokens;
+    std::optional<CDate> m_Date;
+    int m_Year = 0;
+    std::vector<CFilterExpr> m_Children;
+};
+
 class CFilter
 {
 public:
     CFilter(){}
 
     CFilter & name ( const std::string & name ){
-        m_Name.emplace(name);
+        m_Names.push_back(splitToLower(name));
+        std::sort(m_Names.back().begin(), m_Names.back().end());
+        m_NamePrints.push_back(fingerprint(m_Names.back()));
+        m_NameKeys.push_back(joinTokens(m_Names.back()));
         return *this;
     }
     CFilter & bornBefore   ( const CDate  & date ){
@@ -121,136 +442,3091 @@ public:
         return *this;
     }
 
+    // ANDed with the other conditions and with expressions given earlier
+    CFilter & where ( const CFilterExpr & expr ){
+        m_Expr.emplace(m_Expr ? (*m_Expr && expr) : expr);
+        compile();
+        return *this;
+    }
+
     bool matches(const CStudent& student) const{
-        if (m_Name && !nameMatches(student.getName(), m_Name.value()))
+        return matches(student.getName(), student.getDateOfBirth(), student.getEnrolledYear());
+    }
+
+    bool matches(std::string_view name, const CDate &born, int enrolled) const{
+        if (m_Names.empty() && m_Program.empty())
+            return matchesKey({}, 0, born, enrolled);
+        std::string key = foldKey(name);
+        return matchesKey(key, fingerprint(key), born, enrolled);
+    }
+
+    // `key` is foldKey(name) and `print` its fingerprint, the department keeps both per student
+    bool matchesKey(std::string_view key, uint64_t print, const CDate &born, int enrolled) const{
+        if (m_BornBefore && !(born < m_BornBefore.value()))
+            return false;
+        if (m_BornAfter && !(born > m_BornAfter.value()))
             return false;
-        if (m_BornBefore && !(student.getDateOfBirth() < m_BornBefore.value()))
+        if (m_EnrolledBefore && !(enrolled < m_EnrolledBefore.value()))
             return false;
-        if (m_BornAfter && !(student.getDateOfBirth() > m_BornAfter.value()))
+        if (m_EnrolledAfter && !(enrolled > m_EnrolledAfter.value()))
             return false;
-        if (m_EnrolledBefore && !(student.getEnrolledYear() < m_EnrolledBefore.value()))
+        if (!m_Names.empty() && !nameMatches(key, print))
             return false;
-        if (m_EnrolledAfter && !(student.getEnrolledYear() > m_EnrolledAfter.value()))
+        if (!m_Program.empty() && !run(key, print, born, enrolled))
             return false;
         return true;
     }
 
-private:
-    std::optional<std::string> m_Name;
-    std::optional<CDate> m_BornBefore, m_BornAfter;
-    std::optional<int> m_EnrolledBefore, m_EnrolledAfter;
+    // canonical form of the filter, two filters selecting the same students by the same rules share the key
+    std::string key() const {
+        std::vector<std::string> names;
+        for (const auto& tokens : m_Names)
+            names.push_back(joinTokens(tokens));
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+
+        std::ostringstream os;
+        os << 'N';
+        for (const auto& n : names)
+            os << n.size() << ':' << n;
+        os << "|B";
+        if (m_BornBefore) os << m_BornBefore.value();
+        os << "|A";
+        if (m_BornAfter) os << m_BornAfter.value();
+        os << "|E";
+        if (m_EnrolledBefore) os << m_EnrolledBefore.value();
+        os << "|F";
+        if (m_EnrolledAfter) os << m_EnrolledAfter.value();
+        os << "|X" << m_Entry;
+        for (const auto &in : m_Program) {
+            os << ';' << static_cast<int>(in.m_Op) << (in.m_Negate ? '!' : '=');
+            for (const auto &t : in.m_Tokens)
+                os << t.size() << ':' << t;
+            if (in.m_Date) os << in.m_Date.value();
+            os << ',' << in.m_Year << ',' << in.m_OnTrue << ',' << in.m_OnFalse;
+        }
+        return os.str();
+    }
+
+    static std::vector<std::string> splitToLower(std::string_view str) {
+        static thread_local CTokenizer tokenizer;
+        const auto &tokens = tokenizer.split(str);
+        return std::vector<std::string>(tokens.begin(), tokens.end());
+    }
+
+    // order-independent digest of the lowercased tokens: the same token multiset always gives the same
+    // print, so a different print rules a name out without any string work
+    static uint64_t fingerprint(std::string_view name) {
+        static thread_local CTokenizer tokenizer;
+        uint64_t res = 0;
+        for (auto t : tokenizer.split(name))
+            res += tokenPrint(t);
+        return res;
+    }
+
+    static uint64_t fingerprint(const std::vector<std::string> &tokens) {
+        uint64_t res = 0;
+        for (const auto &t : tokens)
+            res += tokenPrint(t);
+        return res;
+    }
+
+    // folded tokens, sorted, joined by single spaces: equal for names matched by name()
+    static std::string foldKey(std::string_view name) {
+        static thread_local CTokenizer tokenizer;
+        auto &tokens = tokenizer.split(name);
+        std::sort(tokens.begin(), tokens.end());
+        std::string res;
+        for (auto t : tokens) {
+            if (!res.empty()) res += ' ';
+            res += t;
+        }
+        return res;
+    }
+
+    static std::string joinTokens(const std::vector<std::string>& tokens) {
+        std::string res;
+        for (const auto& t : tokens) {
+            if (!res.empty()) res += ' ';
+            res += t;
+        }
+        return res;
+    }
+
+private:
+    friend class CStudyDept;
+
+    std::vector<std::vector<std::string>> m_Names;
+    std::vector<uint64_t> m_NamePrints;
+    std::vector<std::string> m_NameKeys;
+    std::optional<CDate> m_BornBefore, m_BornAfter;
+    std::optional<int> m_EnrolledBefore, m_EnrolledAfter;
+
+    using EOp = CFilterExpr::EOp;
+    static constexpr int ACCEPT = -1, REJECT = -2;
+    static constexpr uint64_t FNV_BASIS = 0xcbf29ce484222325ULL, FNV_PRIME = 0x100000001b3ULL;
+
+    // tokens are summed, the finalizer keeps sums of plain FNV values from colliding on related tokens
+    static uint64_t tokenPrint(std::string_view token) {
+        uint64_t h = FNV_BASIS;
+        for (char ch : token)
+            h = (h ^ static_cast<unsigned char>(ch)) * FNV_PRIME;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ h >> 33;
+    }
+
+    // one predicate test, then a jump to the next instruction or to ACCEPT / REJECT
+    struct SInstr {
+        EOp m_Op;
+        bool m_Negate;
+        std::vector<std::string> m_Tokens;
+        std::string m_Key;
+        uint64_t m_Print;
+        std::optional<CDate> m_Date;
+        int m_Year;
+        int m_OnTrue, m_OnFalse;
+    };
+
+    struct SEstimate {
+        double m_Cost;
+        double m_Pass;
+    };
+
+    std::optional<CFilterExpr> m_Expr;
+    std::vector<SInstr> m_Program;
+    int m_Entry = ACCEPT;
+
+    bool run(std::string_view key, uint64_t print, const CDate &born, int enrolled) const {
+        int pc = m_Entry;
+        while (pc >= 0) {
+            const SInstr &in = m_Program[pc];
+            bool res = false;
+            switch (in.m_Op) {
+                case EOp::NAME:
+                    res = in.m_Print == print && in.m_Key == key;
+                    break;
+                case EOp::BORN_BEFORE: res = born < *in.m_Date; break;
+                case EOp::BORN_AFTER: res = born > *in.m_Date; break;
+                case EOp::ENROLLED_BEFORE: res = enrolled < in.m_Year; break;
+                case EOp::ENROLLED_AFTER: res = enrolled > in.m_Year; break;
+                default: break;
+            }
+            pc = res != in.m_Negate ? in.m_OnTrue : in.m_OnFalse;
+        }
+        return pc == ACCEPT;
+    }
+
+    // NOTs are pushed down to the leaves (De Morgan), nested ANDs / ORs are flattened
+    static CFilterExpr pushNot(const CFilterExpr &e, bool negate) {
+        if (e.isLeaf()) {
+            CFilterExpr res = e;
+            res.m_Negate = e.m_Negate != negate;
+            return res;
+        }
+        if (e.m_Op == EOp::NOT)
+            return pushNot(e.m_Children.front(), !negate);
+        EOp op = negate ? (e.m_Op == EOp::AND ? EOp::OR : EOp::AND) : e.m_Op;
+        CFilterExpr res(op);
+        for (const auto &child : e.m_Children) {
+            CFilterExpr part = pushNot(child, negate);
+            if (part.m_Op == op)
+                res.m_Children.insert(res.m_Children.end(), part.m_Children.begin(), part.m_Children.end());
+            else
+                res.m_Children.push_back(std::move(part));
+        }
+        return res;
+    }
+
+    // rough cost of one test and the fraction of students passing it, children of AND / OR are
+    // reordered so the cheap and decisive ones run first
+    static SEstimate reorder(CFilterExpr &e) {
+        if (e.isLeaf()) {
+            SEstimate est{1, 0.5};
+            if (e.m_Op == EOp::NAME)
+                est = SEstimate{8, 0.05};
+            else if (e.m_Op == EOp::BORN_BEFORE || e.m_Op == EOp::BORN_AFTER)
+                est = SEstimate{2, 0.5};
+            if (e.m_Negate)
+                est.m_Pass = 1 - est.m_Pass;
+            return est;
+        }
+
+        bool isAnd = e.m_Op == EOp::AND;
+        std::vector<std::pair<SEstimate, CFilterExpr>> parts;
+        for (auto &child : e.m_Children) {
+            SEstimate est = reorder(child);
+            parts.emplace_back(est, std::move(child));
+        }
+        // an AND wants early failures, an OR early successes
+        auto rank = [isAnd](const SEstimate &est) {
+            double decisive = isAnd ? 1 - est.m_Pass : est.m_Pass;
+            return decisive <= 0 ? HUGE_VAL : est.m_Cost / decisive;
+        };
+        std::stable_sort(parts.begin(), parts.end(), [&rank](const auto &a, const auto &b) {
+            return rank(a.first) < rank(b.first);
+        });
+
+        SEstimate res{0, isAnd ? 1.0 : 0.0};
+        double reach = 1;
+        e.m_Children.clear();
+        for (auto &[est, child] : parts) {
+            res.m_Cost += reach * est.m_Cost;
+            reach *= isAnd ? est.m_Pass : 1 - est.m_Pass;
+            e.m_Children.push_back(std::move(child));
+        }
+        res.m_Pass = isAnd ? reach : 1 - reach;
+        return res;
+    }
+
+    int emit(const CFilterExpr &e, int onTrue, int onFalse) {
+        if (e.isLeaf()) {
+            m_Program.push_back(SInstr{e.m_Op, e.m_Negate, e.m_Tokens, joinTokens(e.m_Tokens), fingerprint(e.m_Tokens), e.m_Date, e.m_Year,
+                                      onTrue, onFalse});
+            return static_cast<int>(m_Program.size()) - 1;
+        }
+        int next = e.m_Op == EOp::AND ? onTrue : onFalse;
+        for (auto it = e.m_Children.rbegin(); it != e.m_Children.rend(); ++it)
+            next = e.m_Op == EOp::AND ? emit(*it, next, onFalse) : emit(*it, onTrue, next);
+        return next;
+    }
+
+    void compile() {
+        CFilterExpr tree = pushNot(*m_Expr, false);
+        reorder(tree);
+        m_Program.clear();
+        m_Entry = emit(tree, ACCEPT, REJECT);
+    }
+
+
+
+    bool indexable() const {
+        return m_Program.empty();
+    }
+
+    // keys are only compared for a filter name with the same print
+    bool nameMatches(std::string_view key, uint64_t print) const {
+        for (size_t i = 0; i < m_Names.size(); ++i)
+            if (m_NamePrints[i] == print && m_NameKeys[i] == key)
+                return true;
+        return false;
+    }
+
+
+};
+
+inline CFilterExpr CFilterExpr::name ( const std::string & name ){
+    CFilterExpr res(EOp::NAME);
+    res.m_Tokens = CFilter::splitToLower(name);
+    std::sort(res.m_Tokens.begin(), res.m_Tokens.end());
+    return res;
+}
+
+class CSort
+{
+public:
+    CSort(){}
+    CSort   & addKey( ESortKey  key ,bool ascending ){
+        m_SortKeys.emplace_back(key,ascending);
+        return *this;
+    }
+
+    bool isEmpty() const {
+        return m_SortKeys.empty();
+    }
+
+    const std::vector<std::pair<ESortKey, bool>> &keys() const {
+        return m_SortKeys;
+    }
+
+
+    bool operator()(const CStudent& lhs, const CStudent& rhs) const {
+        for (const auto& [key, asc] : m_SortKeys) {
+            std::strong_ordering comparison = std::strong_ordering::equal;
+            switch (key) {
+                case ESortKey::NAME:
+                    if (auto cmp = lhs.getName().compare(rhs.getName()); cmp != 0)
+                        return asc ? cmp < 0 : cmp > 0;
+                    break;
+                case ESortKey::BIRTH_DATE:
+                    comparison = lhs.getDateOfBirth() <=> rhs.getDateOfBirth();
+                    if (comparison != std::strong_ordering::equal)
+                        return asc ? (comparison < 0) : (comparison > 0);
+                    break;
+                case ESortKey::ENROLL_YEAR:
+                    if (int cmp = lhs.getEnrolledYear() - rhs.getEnrolledYear(); cmp != 0)
+                        return asc ? cmp < 0 : cmp > 0;
+                    break;
+            }
+        }
+        return false;
+    }
+
+    // canonical form of the sort spec, repeated keys never decide anything so they are dropped
+    std::string key() const {
+        std::string res;
+        bool used[3] = {false, false, false};
+        for (const auto& [key, asc] : m_SortKeys) {
+            auto idx = static_cast<size_t>(key);
+            if (used[idx]) continue;
+            used[idx] = true;
+            res += static_cast<char>('0' + idx);
+            res += asc ? '+' : '-';
+        }
+        return res;
+    }
+
+
+private:
+    std::vector<std::pair<ESortKey, bool>> m_SortKeys;
+};
+
+template <ESortKey Key_, bool Asc_>
+struct CSortKey {
+    static constexpr ESortKey KEY = Key_;
+    static constexpr bool ASC = Asc_;
+
+    // <0 / 0 / >0 in the requested direction
+    static int compare(const CStudent &lhs, const CStudent &rhs) {
+        int cmp;
+        if constexpr (Key_ == ESortKey::NAME)
+            cmp = lhs.getName().compare(rhs.getName());
+        else if constexpr (Key_ == ESortKey::BIRTH_DATE)
+            cmp = (lhs.getDateOfBirth() > rhs.getDateOfBirth()) - (lhs.getDateOfBirth() < rhs.getDateOfBirth());
+        else
+            cmp = (lhs.getEnrolledYear() > rhs.getEnrolledYear()) - (lhs.getEnrolledYear() < rhs.getEnrolledYear());
+        return Asc_ ? cmp : -cmp;
+    }
+};
+
+// sort order fixed at compile time, the comparator is one inlined chain with no per-key switch
+template <typename ... Keys_>
+class CStaticSort
+{
+public:
+    bool operator()(const CStudent& lhs, const CStudent& rhs) const {
+        int cmp = 0;
+        ((cmp = cmp != 0 ? cmp : Keys_::compare(lhs, rhs)), ...);
+        return cmp < 0;
+    }
+
+    // the same order as a runtime spec, for cache keys, indexes and anything else taking a CSort
+    static const CSort &dynamic() {
+        static const CSort sort = [] {
+            CSort res;
+            (res.addKey(Keys_::KEY, Keys_::ASC), ...);
+            return res;
+        }();
+        return sort;
+    }
+
+    operator const CSort &() const {
+        return dynamic();
+    }
+};
+
+
+// small LRU keyed by canonical query strings, entries older than the current generation are stale. Bounded
+// both by entries and by the rows (elements) of all cached values together; a value alone over the row
+// budget is not cached at all
+template <typename T_>
+class CLruCache {
+public:
+    explicit CLruCache(size_t capacity, size_t rows = SIZE_MAX) : m_Capacity(capacity), m_RowBudget(rows) {}
+
+    const T_ * find(const std::string &key, size_t generation) {
+        auto it = m_Lookup.find(key);
+        if (it == m_Lookup.end())
+            return nullptr;
+        if (it->second->m_Generation != generation) {
+            drop(it);
+            return nullptr;
+        }
+        m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+        return &it->second->m_Value;
+    }
+
+    // whether find would hit, leaving recency and stale entries as they are
+    bool contains(const std::string &key, size_t generation) const {
+        auto it = m_Lookup.find(key);
+        return it != m_Lookup.end() && it->second->m_Generation == generation;
+    }
+
+    void insert(const std::string &key, size_t generation, T_ value) {
+        if (auto it = m_Lookup.find(key); it != m_Lookup.end())
+            drop(it);
+        if (m_Capacity == 0 || value.size() > m_RowBudget)
+            return;
+        m_Rows += value.size();
+        m_Entries.push_front(SEntry{key, generation, std::move(value)});
+        m_Lookup.emplace(key, m_Entries.begin());
+        while (m_Entries.size() > m_Capacity || m_Rows > m_RowBudget)
+            drop(m_Lookup.find(m_Entries.back().m_Key));
+    }
+
+    size_t size() const {
+        return m_Entries.size();
+    }
+
+    // elements of all cached values together
+    size_t rows() const {
+        return m_Rows;
+    }
+
+private:
+    struct SEntry {
+        std::string m_Key;
+        size_t m_Generation;
+        T_ m_Value;
+    };
+
+    void drop(typename std::unordered_map<std::string, typename std::list<SEntry>::iterator>::iterator it) {
+        m_Rows -= it->second->m_Value.size();
+        m_Entries.erase(it->second);
+        m_Lookup.erase(it);
+    }
+
+    size_t m_Capacity;
+    size_t m_RowBudget;
+    size_t m_Rows = 0;
+    std::list<SEntry> m_Entries;
+    std::unordered_map<std::string, typename std::list<SEntry>::iterator> m_Lookup;
+};
+
+
+// orders students by a sort spec, ties keep insertion order
+class CStudentOrder {
+public:
+    explicit CStudentOrder(const CSort &sort) : m_Sort(sort) {}
+
+    bool operator()(const CStudent &lhs, const CStudent &rhs) const {
+        if (m_Sort(lhs, rhs)) return true;
+        if (m_Sort(rhs, lhs)) return false;
+        return lhs.getStudentId() < rhs.getStudentId();
+    }
+
+private:
+    CSort m_Sort;
+};
+
+struct SViewChange {
+    bool m_Added;
+    CStudent m_Student;
+};
+
+// standing search kept up to date by the department on every add / del. The department hands out copies,
+// its own view keeps at most `maxChanges` undrained changes and counts the older ones it dropped in lost()
+class CStudyView {
+public:
+    CStudyView(const CFilter &filter, const CSort &sort, size_t maxChanges = 4096)
+            : m_Filter(filter), m_Rows(CStudentOrder(sort)), m_MaxChanges(std::max<size_t>(maxChanges, 1)) {}
+
+    const std::set<CStudent, CStudentOrder> &rows() const {
+        return m_Rows;
+    }
+
+    // rows added / removed since the changes were last taken, in mutation order
+    const std::deque<SViewChange> &changes() const {
+        return m_Changes;
+    }
+
+    size_t lost() const {
+        return m_Lost;
+    }
+
+private:
+    friend class CStudyDept;
+
+    void onAdd(const CStudent &x) {
+        if (!m_Filter.matches(x))
+            return;
+        m_Rows.insert(x);
+        record(true, x);
+    }
+
+    void onDel(const CStudent &x) {
+        if (m_Rows.erase(x))
+            record(false, x);
+    }
+
+    // every row goes away, reported in row order
+    void onClear() {
+        for (const CStudent &x : m_Rows)
+            record(false, x);
+        m_Rows.clear();
+    }
+
+    void record(bool added, const CStudent &x) {
+        if (m_Changes.size() == m_MaxChanges) {
+            m_Changes.pop_front();
+            ++m_Lost;
+        }
+        m_Changes.push_back(SViewChange{added, x});
+    }
+
+    std::vector<SViewChange> take() {
+        std::vector<SViewChange> res(std::make_move_iterator(m_Changes.begin()), std::make_move_iterator(m_Changes.end()));
+        m_Changes.clear();
+        return res;
+    }
+
+    CFilter m_Filter;
+    std::set<CStudent, CStudentOrder> m_Rows;
+    std::deque<SViewChange> m_Changes;
+    size_t m_MaxChanges;
+    size_t m_Lost = 0;
+};
+
+
+class CQueryCancelled : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// stop request and deadline of one asynchronous query, scans poll it every few hundred rows
+class CCancel {
+public:
+    using TClock = std::chrono::steady_clock;
+
+    CCancel(std::stop_token stop, TClock::time_point deadline) : m_Stop(std::move(stop)), m_Deadline(deadline) {}
+
+    void check() const {
+        if (m_Stop.stop_requested())
+            throw CQueryCancelled("Query cancelled.\n");
+        if (m_Deadline != TClock::time_point::max() && TClock::now() >= m_Deadline)
+            throw CQueryCancelled("Query deadline exceeded.\n");
+    }
+
+    static void poll(const CCancel *cancel, size_t &rows) {
+        if (cancel && (++rows & 511) == 0)
+            cancel->check();
+    }
+
+private:
+    std::stop_token m_Stop;
+    TClock::time_point m_Deadline;
+};
+
+// fixed pool of worker threads running posted jobs in FIFO order, drains the queue before it is destroyed
+class CExecutor {
+public:
+    explicit CExecutor(size_t threads) {
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+            m_Workers.emplace_back([this] { work(); });
+    }
+
+    ~CExecutor() {
+        {
+            std::lock_guard lock(m_Lock);
+            m_Stop = true;
+        }
+        m_Ready.notify_all();
+        for (auto &worker : m_Workers)
+            worker.join();
+    }
+
+    CExecutor(const CExecutor &) = delete;
+    CExecutor &operator=(const CExecutor &) = delete;
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard lock(m_Lock);
+            m_Jobs.push_back(std::move(job));
+        }
+        m_Ready.notify_one();
+    }
+
+private:
+    void work() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(m_Lock);
+                m_Ready.wait(lock, [this] { return m_Stop || !m_Jobs.empty(); });
+                if (m_Jobs.empty())
+                    return;
+                job = std::move(m_Jobs.front());
+                m_Jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex m_Lock;
+    std::condition_variable m_Ready;
+    std::deque<std::function<void()>> m_Jobs;
+    bool m_Stop = false;
+    std::vector<std::thread> m_Workers;
+};
+
+struct SMutation {
+    bool m_Added;
+    // position in the feed, consecutive for consecutive mutations
+    uint64_t m_Seq;
+    CStudent m_Student;
+};
+
+// ring of department mutations: one writer (the department under its write lock), any number of independent
+// readers. The writer never waits; a reader that falls a whole ring behind jumps to the newer half of the ring
+// and counts what it missed in lost(). Every slot is a seqlock, a mutation whose name does not fit the first
+// slot continues in the following ones.
+class CChangeFeed {
+public:
+    explicit CChangeFeed(size_t capacity)
+            : m_Mask(slotsFor(capacity) - 1), m_Slots(new SSlot[m_Mask + 1]) {}
+
+    // ring slots a requested capacity gets
+    static size_t slotsFor(size_t capacity) {
+        return std::bit_ceil(std::max<size_t>(capacity, 2));
+    }
+
+    void publish(bool added, int id, std::string_view name, const CDate &born, int enrolled) {
+        static_assert(std::is_trivially_copyable_v<CDate> && sizeof(CDate) <= 2 * sizeof(uint64_t));
+        uint64_t words[WORDS] = {};
+        uint64_t seq = m_Head.load(std::memory_order_relaxed);
+        uint64_t event = m_Events.load(std::memory_order_relaxed);
+        words[0] = FIRST | uint64_t(added) << 1 | uint64_t(name.size()) << 8;
+        words[1] = event;
+        words[2] = uint64_t(uint32_t(id)) | uint64_t(uint32_t(enrolled)) << 32;
+        std::memcpy(&words[3], &born, sizeof(CDate));
+        size_t chunk = std::min(name.size(), (WORDS - HEADER) * sizeof(uint64_t));
+        std::memcpy(&words[HEADER], name.data(), chunk);
+        write(seq++, words);
+        for (size_t done = chunk; done < name.size(); done += chunk) {
+            chunk = std::min(name.size() - done, (WORDS - 1) * sizeof(uint64_t));
+            std::fill(std::begin(words), std::end(words), 0);
+            std::memcpy(&words[1], name.data() + done, chunk);
+            write(seq++, words);
+        }
+        m_Head.store(seq, std::memory_order_release);
+        m_Events.store(event + 1, std::memory_order_release);
+    }
+
+    uint64_t head() const {
+        return m_Head.load(std::memory_order_acquire);
+    }
+
+    uint64_t events() const {
+        return m_Events.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return m_Mask + 1;
+    }
+
+private:
+    friend class CFeedSubscriber;
+
+    static constexpr size_t WORDS = 15;
+    static constexpr size_t HEADER = 5;
+    // set in the first slot of a mutation, clear in its continuation slots
+    static constexpr uint64_t FIRST = 1;
+
+    struct alignas(64) SSlot {
+        // 2 * seq + 1 while slot `seq` is written, 2 * seq + 2 once it is complete
+        std::atomic<uint64_t> m_Version{0};
+        std::atomic<uint64_t> m_Words[WORDS];
+    };
+
+    void write(uint64_t seq, const uint64_t *words) {
+        SSlot &slot = m_Slots[seq & m_Mask];
+        slot.m_Version.store(2 * seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i)
+            slot.m_Words[i].store(words[i], std::memory_order_relaxed);
+        slot.m_Version.store(2 * seq + 2, std::memory_order_release);
+    }
+
+    // false if the slot does not hold a complete `seq`, i.e. it has been overwritten meanwhile
+    bool read(uint64_t seq, uint64_t *words) const {
+        const SSlot &slot = m_Slots[seq & m_Mask];
+        uint64_t version = slot.m_Version.load(std::memory_order_acquire);
+        if (version != 2 * seq + 2)
+            return false;
+        for (size_t i = 0; i < WORDS; ++i)
+            words[i] = slot.m_Words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.m_Version.load(std::memory_order_relaxed) == version;
+    }
+
+    size_t m_Mask;
+    std::unique_ptr<SSlot[]> m_Slots;
+    std::atomic<uint64_t> m_Head{0};
+    std::atomic<uint64_t> m_Events{0};
+};
+
+// one reader of a change feed, not shared between threads; keeps the feed alive on its own
+class CFeedSubscriber {
+public:
+    CFeedSubscriber(std::shared_ptr<const CChangeFeed> feed)
+            : m_Feed(std::move(feed)), m_Cursor(m_Feed->head()), m_NextEvent(m_Feed->events()) {}
+
+    // appends up to `maxEvents` mutations published since the previous call
+    size_t poll(std::vector<SMutation> &out, size_t maxEvents = SIZE_MAX) {
+        size_t got = 0;
+        uint64_t words[CChangeFeed::WORDS];
+        while (got < maxEvents) {
+            uint64_t head = m_Feed->head();
+            if (m_Cursor >= head)
+                break;
+            if (head - m_Cursor > m_Feed->capacity() || !m_Feed->read(m_Cursor, words)) {
+                skipAhead();
+                continue;
+            }
+            if (!(words[0] & CChangeFeed::FIRST)) {
+                ++m_Cursor;
+                continue;
+            }
+
+            size_t length = words[0] >> 8;
+            uint64_t event = words[1];
+            CDate born(0, 0, 0);
+            std::memcpy(static_cast<void *>(&born), &words[3], sizeof(CDate));
+            std::string name(reinterpret_cast<const char *>(&words[CChangeFeed::HEADER]),
+                             std::min(length, (CChangeFeed::WORDS - CChangeFeed::HEADER) * sizeof(uint64_t)));
+            CStudent student("", born, int(uint32_t(words[2] >> 32)));
+            bool added = words[0] >> 1 & 1;
+            int id = int(uint32_t(words[2]));
+
+            uint64_t seq = m_Cursor + 1;
+            bool complete = true;
+            while (name.size() < length) {
+                if (!m_Feed->read(seq++, words)) {
+                    complete = false;
+                    break;
+                }
+                name.append(reinterpret_cast<const char *>(&words[1]),
+                            std::min(length - name.size(), (CChangeFeed::WORDS - 1) * sizeof(uint64_t)));
+            }
+            if (!complete) {
+                skipAhead();
+                continue;
+            }
+
+            m_Cursor = seq;
+            if (event > m_NextEvent)
+                m_Lost += event - m_NextEvent;
+            m_NextEvent = event + 1;
+            out.push_back(SMutation{added, event, CStudent(name, student.getDateOfBirth(), student.getEnrolledYear())});
+            out.back().m_Student.m_id = id;
+            ++got;
+        }
+        return got;
+    }
+
+    uint64_t lost() const {
+        return m_Lost;
+    }
+
+private:
+    // resumes half a ring behind the writer, the gap in event numbers shows up as lost on the next read
+    void skipAhead() {
+        uint64_t head = m_Feed->head(), keep = m_Feed->capacity() / 2;
+        m_Cursor = std::max(m_Cursor + 1, head > keep ? head - keep : 0);
+    }
+
+    std::shared_ptr<const CChangeFeed> m_Feed;
+    uint64_t m_Cursor;
+    uint64_t m_NextEvent;
+    uint64_t m_Lost = 0;
+};
+
+// increasing slot numbers of the students holding one name token. Full blocks of 128 are stored as deltas
+// bit-packed to the widest delta of the block, four lanes interleaved so SSE2 unpacks four at a time; the
+// first and last slot of every block double as skip pointers. The block being filled stays unpacked
+class CPostingList {
+public:
+    static constexpr size_t BLOCK = 128;
+
+    void append(uint32_t slot) {
+        m_Tail.push_back(slot);
+        ++m_Size;
+        if (m_Tail.size() == BLOCK) {
+            pack();
+            m_Tail.clear();
+        }
+    }
+
+    size_t size() const {
+        return m_Size;
+    }
+
+    size_t bytes() const {
+        return m_Blocks.size() * sizeof(SBlock) + m_Words.size() * sizeof(uint32_t) + m_Tail.size() * sizeof(uint32_t);
+    }
+
+    // forward-only reader; seek() gallops over the skip pointers first, then inside the decoded block
+    class CCursor {
+    public:
+        explicit CCursor(const CPostingList &list) : m_List(&list) {
+            load(0);
+        }
+
+        bool done() const {
+            return m_Pos >= m_Count;
+        }
+
+        uint32_t value() const {
+            return m_Values[m_Pos];
+        }
+
+        void next() {
+            if (++m_Pos == m_Count)
+                load(m_Block + 1);
+        }
+
+        // moves to the first slot >= target
+        void seek(uint32_t target) {
+            if (done() || value() >= target)
+                return;
+            if (m_List->last(m_Block) < target) {
+                size_t blocks = m_List->blocks(), lo = m_Block + 1, hi = lo;
+                for (size_t step = 1; hi < blocks && m_List->last(hi) < target; step *= 2) {
+                    lo = hi + 1;
+                    hi += step;
+                }
+                hi = std::min(hi, blocks);
+                while (lo < hi) {
+                    size_t mid = (lo + hi) / 2;
+                    if (m_List->last(mid) < target)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                load(lo);
+                if (done())
+                    return;
+            }
+            size_t lo = m_Pos, hi = m_Pos;
+            for (size_t step = 1; hi < m_Count && m_Values[hi] < target; step *= 2) {
+                lo = hi + 1;
+                hi += step;
+            }
+            m_Pos = std::lower_bound(m_Values + lo, m_Values + std::min(hi + 1, m_Count), target) - m_Values;
+        }
+
+    private:
+        void load(size_t block) {
+            m_Block = block;
+            m_Pos = 0;
+            m_Count = 0;
+            if (block < m_List->m_Blocks.size()) {
+                m_List->decode(block, m_Values);
+                m_Count = BLOCK;
+            } else if (block == m_List->m_Blocks.size()) {
+                std::copy(m_List->m_Tail.begin(), m_List->m_Tail.end(), m_Values);
+                m_Count = m_List->m_Tail.size();
+            }
+        }
+
+        const CPostingList *m_List;
+        size_t m_Block = 0;
+        size_t m_Pos = 0;
+        size_t m_Count = 0;
+        alignas(16) uint32_t m_Values[BLOCK];
+    };
+
+    // calls fn for every slot present in all the lists, leapfrogging the cursors over each other
+    template <typename F_>
+    static void intersect(const std::vector<const CPostingList *> &lists, F_ fn, const CCancel *cancel) {
+        if (lists.empty())
+            return;
+        std::vector<CCursor> cursors;
+        cursors.reserve(lists.size());
+        for (const auto *list : lists)
+            cursors.emplace_back(*list);
+        size_t rows = 0;
+        while (!cursors.front().done()) {
+            uint32_t target = cursors.front().value();
+            bool all = true;
+            for (size_t i = 1; i < cursors.size() && all; ++i) {
+                CCancel::poll(cancel, rows);
+                cursors[i].seek(target);
+                if (cursors[i].done())
+                    return;
+                if (cursors[i].value() != target) {
+                    cursors.front().seek(cursors[i].value());
+                    all = false;
+                }
+            }
+            if (all) {
+                fn(target);
+                cursors.front().next();
+            }
+        }
+    }
+
+private:
+    struct SBlock {
+        uint32_t m_First;
+        uint32_t m_Last;
+        uint32_t m_Offset;
+        uint32_t m_Bits;
+    };
+
+    // packed blocks followed by the tail as one more block, if it is not empty
+    size_t blocks() const {
+        return m_Blocks.size() + !m_Tail.empty();
+    }
+
+    uint32_t last(size_t block) const {
+        return block < m_Blocks.size() ? m_Blocks[block].m_Last : m_Tail.back();
+    }
+
+    // value 4 * j + lane of the block takes bits [j * bits, (j + 1) * bits) of the lane's words
+    void pack() {
+        uint32_t deltas[BLOCK] = {0}, any = 0;
+        for (size_t i = 1; i < BLOCK; ++i)
+            any |= deltas[i] = m_Tail[i] - m_Tail[i - 1];
+        SBlock blk{m_Tail.front(), m_Tail.back(), static_cast<uint32_t>(m_Words.size()),
+                   static_cast<uint32_t>(32 - std::countl_zero(any))};
+        m_Words.resize(m_Words.size() + 4 * blk.m_Bits, 0);
+        uint32_t *out = m_Words.data() + blk.m_Offset;
+        for (size_t j = 0; j < BLOCK / 4 && blk.m_Bits > 0; ++j)
+            for (size_t lane = 0; lane < 4; ++lane) {
+                uint32_t v = deltas[4 * j + lane];
+                size_t bit = j * blk.m_Bits, word = bit / 32, shift = bit % 32;
+                out[4 * word + lane] |= v << shift;
+                if (shift + blk.m_Bits > 32)
+                    out[4 * (word + 1) + lane] |= v >> (32 - shift);
+            }
+        m_Blocks.push_back(blk);
+    }
+
+    void decode(size_t block, uint32_t *out) const {
+        const SBlock &blk = m_Blocks[block];
+        const uint32_t *in = m_Words.data() + blk.m_Offset;
+        uint32_t bits = blk.m_Bits, mask = bits == 32 ? UINT32_MAX : (uint32_t(1) << bits) - 1;
+        if (bits == 0) {
+            std::fill(out, out + BLOCK, blk.m_First);
+            return;
+        }
+#if defined(__SSE2__)
+        __m128i vmask = _mm_set1_epi32(static_cast<int>(mask));
+        __m128i run = _mm_set1_epi32(static_cast<int>(blk.m_First));
+        for (size_t j = 0; j < BLOCK / 4; ++j) {
+            size_t bit = j * bits, word = bit / 32, shift = bit % 32;
+            __m128i v = _mm_srl_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 4 * word)),
+                                      _mm_cvtsi32_si128(static_cast<int>(shift)));
+            if (shift + bits > 32)
+                v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 4 * word + 4)),
+                                                  _mm_cvtsi32_si128(static_cast<int>(32 - shift))));
+            v = _mm_and_si128(v, vmask);
+            // prefix sum of the four deltas, carried on from the previous four
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi32(v, run);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4 * j), v);
+            run = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+#else
+        uint32_t run = blk.m_First;
+        for (size_t j = 0; j < BLOCK / 4; ++j)
+            for (size_t lane = 0; lane < 4; ++lane) {
+                size_t bit = j * bits, word = bit / 32, shift = bit % 32;
+                uint32_t v = in[4 * word + lane] >> shift;
+                if (shift + bits > 32)
+                    v |= in[4 * (word + 1) + lane] << (32 - shift);
+                run += v & mask;
+                out[4 * j + lane] = run;
+            }
+#endif
+    }
+
+    std::vector<SBlock> m_Blocks;
+    std::vector<uint32_t> m_Words;
+    std::vector<uint32_t> m_Tail;
+    size_t m_Size = 0;
+};
+
+// sorted keys in the BFS order of an implicit binary search tree (Eytzinger layout): the top levels share a
+// few cache lines and every step prefetches the node's descendants as many levels down as fit one cache line
+// together (16 ints, 4 dates), so a lookup costs a handful of misses whatever the size. Each key also carries
+// how many entries precede it
+template <typename T_>
+class CEytzinger {
+public:
+    CEytzinger() = default;
+
+    // distinct keys in ascending order with the number of entries at each
+    explicit CEytzinger(const std::vector<std::pair<T_, size_t>> &sorted) : m_Size(sorted.size()) {
+        if (sorted.empty())
+            return;
+        m_Keys.assign(m_Size + 1, sorted.front().first);
+        m_Before.assign(m_Size + 1, 0);
+        size_t next = 0, before = 0;
+        build(1, sorted, next, before);
+        m_Before[0] = before;
+    }
+
+    // entries with a key below x
+    size_t countBelow(const T_ &x) const {
+        return m_Before[find([&x](const T_ &key) { return key < x; })];
+    }
+
+    // entries with a key not above x
+    size_t countUpTo(const T_ &x) const {
+        return m_Before[find([&x](const T_ &key) { return !(x < key); })];
+    }
+
+    size_t total() const {
+        return m_Before.empty() ? 0 : m_Before[0];
+    }
+
+private:
+    void build(size_t k, const std::vector<std::pair<T_, size_t>> &sorted, size_t &next, size_t &before) {
+        if (k > m_Size)
+            return;
+        build(2 * k, sorted, next, before);
+        m_Keys[k] = sorted[next].first;
+        m_Before[k] = before;
+        before += sorted[next++].second;
+        build(2 * k + 1, sorted, next, before);
+    }
+
+    // node of the first key for which goRight is false, 0 past the end; the descent records a right turn as a
+    // 1 bit, so dropping the trailing right turns and the last left one leads back to that node
+    template <typename F_>
+    size_t find(F_ goRight) const {
+        size_t k = 1;
+        while (k <= m_Size) {
+#if defined(__GNUC__)
+            if (PREFETCH * k <= m_Size)
+                __builtin_prefetch(m_Keys.data() + PREFETCH * k);
+#endif
+            k = 2 * k + goRight(m_Keys[k]);
+        }
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    // descendants of a node on one level are adjacent, a power of two of them fills at most one line
+    static constexpr size_t PREFETCH = std::bit_floor(std::max<size_t>(64 / sizeof(T_), 1));
+
+    size_t m_Size = 0;
+    std::vector<T_> m_Keys;
+    // m_Before[k]: entries with a key below m_Keys[k]; m_Before[0]: all of them
+    std::vector<size_t> m_Before = {0};
+};
+
+enum class EExportFormat {
+    CSV,
+    JSON
+};
+
+// formats rows straight into one reusable buffer and writes it to a descriptor whenever it runs full. CSV
+// quotes a name only when it needs it, JSON is an array with one object per line
+class CExportWriter {
+public:
+    CExportWriter(int fd, EExportFormat format, size_t capacity = 1 << 16)
+            : m_Fd(fd), m_Format(format), m_Buffer(std::max<size_t>(capacity, 256)) {
+        put(m_Format == EExportFormat::CSV ? "name,born,enrolled\n" : "[");
+    }
+
+    CExportWriter(const CExportWriter &) = delete;
+    CExportWriter &operator=(const CExportWriter &) = delete;
+
+    void row(std::string_view name, int year, int month, int day, int enrolled) {
+        if (m_Format == EExportFormat::CSV) {
+            if (name.find_first_of(",\"\r\n") == std::string_view::npos) {
+                put(name);
+            } else {
+                put('"');
+                for (char ch : name) {
+                    if (ch == '"')
+                        put('"');
+                    put(ch);
+                }
+                put('"');
+            }
+            put(',');
+            date(year, month, day);
+            put(',');
+            number(enrolled);
+            put('\n');
+        } else {
+            put(m_Rows ? ",\n{\"name\":\"" : "\n{\"name\":\"");
+            for (char ch : name) {
+                auto uch = static_cast<unsigned char>(ch);
+                if (ch == '"' || ch == '\\') {
+                    put('\\');
+                    put(ch);
+                } else if (uch < 0x20) {
+                    static const char HEX[] = "0123456789abcdef";
+                    put("\\u00");
+                    put(HEX[uch >> 4]);
+                    put(HEX[uch & 15]);
+                } else {
+                    put(ch);
+                }
+            }
+            put("\",\"born\":\"");
+            date(year, month, day);
+            put("\",\"enrolled\":");
+            number(enrolled);
+            put('}');
+        }
+        ++m_Rows;
+    }
+
+    // closes the JSON array and writes whatever is buffered, returns the number of rows
+    size_t finish() {
+        if (m_Format == EExportFormat::JSON)
+            put(m_Rows ? "\n]\n" : "]\n");
+        flush();
+        return m_Rows;
+    }
+
+private:
+    void put(char ch) {
+        if (m_Used == m_Buffer.size())
+            flush();
+        m_Buffer[m_Used++] = ch;
+    }
+
+    void put(std::string_view str) {
+        for (size_t done = 0; done < str.size();) {
+            if (m_Used == m_Buffer.size())
+                flush();
+            size_t chunk = std::min(str.size() - done, m_Buffer.size() - m_Used);
+            std::memcpy(m_Buffer.data() + m_Used, str.data() + done, chunk);
+            m_Used += chunk;
+            done += chunk;
+        }
+    }
+
+    void number(int value) {
+        // an int takes at most 11 characters
+        if (m_Buffer.size() - m_Used < 11)
+            flush();
+        m_Used = std::to_chars(m_Buffer.data() + m_Used, m_Buffer.data() + m_Buffer.size(), value).ptr - m_Buffer.data();
+    }
+
+    // the same y-m-d form as CDate's operator <<
+    void date(int year, int month, int day) {
+        number(year);
+        put('-');
+        number(month);
+        put('-');
+        number(day);
+    }
+
+    void flush() {
+        for (size_t done = 0; done < m_Used;) {
+            ssize_t n = ::write(m_Fd, m_Buffer.data() + done, m_Used - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error("Export write failed.\n");
+            done += static_cast<size_t>(n);
+        }
+        m_Used = 0;
+    }
+
+    int m_Fd;
+    EExportFormat m_Format;
+    std::vector<char> m_Buffer;
+    size_t m_Used = 0;
+    size_t m_Rows = 0;
+};
+
+// built-in instrumentation, compiled out with -DSTUDYDEPT_STATS=0
+#ifndef STUDYDEPT_STATS
+#define STUDYDEPT_STATS 1
+#endif
+
+enum class EStatOp {
+    ADD,
+    DEL,
+    SEARCH,
+    SUGGEST
+};
+
+enum class EStat {
+    ROWS_SCANNED,
+    ROWS_RETURNED,
+    NAME_INDEX,
+    COMPOSITE_INDEX,
+    FROZEN_INDEX,
+    FULL_SCAN,
+    SEARCH_CACHE_HIT,
+    SEARCH_CACHE_MISS,
+    SUGGEST_CACHE_HIT,
+    SUGGEST_CACHE_MISS
+};
+
+// latencies in nanoseconds, log-linear buckets as in HDR histograms: 16 per power of two, so any recorded
+// value is known to within 1/16 of itself
+class CLatencyHistogram {
+public:
+    static constexpr size_t SUB = 16;
+    static constexpr size_t BUCKETS = SUB * 34;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < SUB)
+            return ns;
+        size_t shift = std::bit_width(ns) - 5;
+        return std::min(SUB * (shift + 1) + (ns >> shift & (SUB - 1)), BUCKETS - 1);
+    }
+
+    static uint64_t lowerBound(size_t bucket) {
+        if (bucket < SUB)
+            return bucket;
+        return (SUB + bucket % SUB) << (bucket / SUB - 1);
+    }
+
+    void add(size_t bucket, uint64_t count, uint64_t sum) {
+        m_Counts[bucket] += count;
+        m_Total += count;
+        m_Sum += sum;
+    }
+
+    void merge(const CLatencyHistogram &other) {
+        for (size_t i = 0; i < BUCKETS; ++i)
+            m_Counts[i] += other.m_Counts[i];
+        m_Total += other.m_Total;
+        m_Sum += other.m_Sum;
+    }
+
+    uint64_t count() const {
+        return m_Total;
+    }
+
+    double mean() const {
+        return m_Total ? static_cast<double>(m_Sum) / m_Total : 0;
+    }
+
+    // upper end of the bucket holding the q-quantile, 0 when empty
+    uint64_t percentile(double q) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * m_Total)), seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+            if ((seen += m_Counts[i]) >= std::max<uint64_t>(rank, 1))
+                return i + 1 < BUCKETS ? lowerBound(i + 1) - 1 : UINT64_MAX;
+        return 0;
+    }
+
+private:
+    std::array<uint64_t, BUCKETS> m_Counts{};
+    uint64_t m_Total = 0;
+    uint64_t m_Sum = 0;
+};
+
+// snapshot returned by CStudyDept::stats()
+struct SStudyStats {
+    std::array<CLatencyHistogram, 4> m_Latency;
+    std::array<uint64_t, 10> m_Counters{};
+
+    const CLatencyHistogram &latency(EStatOp op) const {
+        return m_Latency[static_cast<size_t>(op)];
+    }
+
+    uint64_t operator[](EStat stat) const {
+        return m_Counters[static_cast<size_t>(stat)];
+    }
+
+    void merge(const SStudyStats &other) {
+        for (size_t i = 0; i < m_Latency.size(); ++i)
+            m_Latency[i].merge(other.m_Latency[i]);
+        for (size_t i = 0; i < m_Counters.size(); ++i)
+            m_Counters[i] += other.m_Counters[i];
+    }
+};
+
+// written by its own thread only and read by stats(): a relaxed load and store, no locked add
+class CStatCounter {
+public:
+    void add(uint64_t n = 1) {
+        m_Value.store(m_Value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return m_Value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_Value{0};
+};
+
+// one step of an explained search: rows it read, rows it was expected to and did pass on, time spent in it
+struct SPlanStage {
+    std::string m_Name;
+    size_t m_RowsIn = 0;
+    size_t m_Estimated = 0;
+    size_t m_Actual = 0;
+    std::chrono::nanoseconds m_Time{0};
+};
+
+// how CStudyDept::search answers a query, as measured by CStudyDept::explain
+struct SQueryPlan {
+    // index driving the scan: "name index", "frozen birth dates", "frozen enroll years", "composite index"
+    // or "full scan"
+    std::string m_Access;
+    // search would currently return a cached result without running the plan
+    bool m_Cached = false;
+    // false when the order of the driving index already is the requested one
+    bool m_SortNeeded = false;
+    std::vector<SPlanStage> m_Stages;
+
+    std::chrono::nanoseconds total() const {
+        std::chrono::nanoseconds res{0};
+        for (const auto &stage : m_Stages)
+            res += stage.m_Time;
+        return res;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const SQueryPlan &plan) {
+        os << plan.m_Access << (plan.m_Cached ? " (cached)" : "") << (plan.m_SortNeeded ? ", sorted" : ", index order")
+           << '\n';
+        for (const auto &stage : plan.m_Stages)
+            os << "  " << stage.m_Name << ": in " << stage.m_RowsIn << ", est " << stage.m_Estimated << ", out "
+               << stage.m_Actual << ", " << stage.m_Time.count() << " ns\n";
+        return os;
+    }
+};
+
+// times the stages of an explained search, does nothing without a plan
+class CPlanRecorder {
+public:
+    using TClock = std::chrono::steady_clock;
+
+    explicit CPlanRecorder(SQueryPlan *plan) : m_Plan(plan) {
+        if (m_Plan)
+            m_Start = TClock::now();
+    }
+
+    explicit operator bool() const {
+        return m_Plan != nullptr;
+    }
+
+    SQueryPlan *operator->() const {
+        return m_Plan;
+    }
+
+    // closes the stage that began at the previous call, `excluded` is time already booked to another stage
+    void stage(std::string name, size_t in, size_t estimated, size_t actual,
+               std::chrono::nanoseconds excluded = std::chrono::nanoseconds{0}) {
+        if (!m_Plan)
+            return;
+        auto now = TClock::now();
+        m_Plan->m_Stages.push_back(SPlanStage{std::move(name), in, estimated, actual, now - m_Start - excluded});
+        m_Start = now;
+    }
+
+private:
+    SQueryPlan *m_Plan;
+    TClock::time_point m_Start;
+};
+
+// department-owned name bytes, records keep an offset into one growing buffer instead of a string each
+class CNameArena {
+public:
+    explicit CNameArena(std::pmr::memory_resource *resource) : m_Bytes(resource) {}
+
+    size_t store(std::string_view name) {
+        size_t offset = m_Bytes.size();
+        m_Bytes.insert(m_Bytes.end(), name.begin(), name.end());
+        return offset;
+    }
+
+    std::string_view get(size_t offset, size_t length) const {
+        return {m_Bytes.data() + offset, length};
+    }
+
+private:
+    std::pmr::vector<char> m_Bytes;
+};
+
+struct SRecord {
+    size_t m_NameOff;
+    size_t m_NameLen;
+    // CFilter::foldKey of the name, stored in the arena right after the name
+    size_t m_KeyLen;
+    // CFilter::fingerprint of the name
+    uint64_t m_NamePrint;
+    CDate m_Born;
+    int m_Enrolled;
+    int m_Id;
+};
+
+
+class CStudyDept {
+public:
+    CStudyDept(size_t cacheSize = 64, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : m_Resource(resource), m_Store(std::make_unique<SStore>(resource)), m_SearchCache(cacheSize, CACHE_ROWS),
+              m_SuggestCache(cacheSize, CACHE_ROWS), m_EnrollCount(resource), m_BirthCount(resource), m_NameEnrollCount(resource) {}
+
+    // records point into the store's arena and the indexes into the store, a copy would point into the source
+    CStudyDept(const CStudyDept &) = delete;
+    CStudyDept &operator=(const CStudyDept &) = delete;
+
+    bool addStudent(const CStudent &x){
+        return emplaceStudent(x.getName(), x.getDateOfBirth(), x.getEnrolledYear());
+    }
+
+    // the arena takes its own copy of the bytes, a moved-in student has nothing more to give
+    bool addStudent(CStudent &&x){
+        return emplaceStudent(x.getName(), x.getDateOfBirth(), x.getEnrolledYear());
+    }
+
+    // builds the record in place, a rejected duplicate allocates nothing
+    bool emplaceStudent(std::string_view name, const CDate &born, int enrolled){
+        CStatsTimer timer(*this, EStatOp::ADD);
+        std::unique_lock lock(m_Lock);
+        SStore &store = *m_Store;
+        if (store.m_Index.find(SProbe{name, born, enrolled}) != store.m_Index.end())
+            return false;
+        m_Frozen.reset();
+        size_t slot = store.m_Records.size();
+        std::string key = CFilter::foldKey(name);
+        size_t offset = store.m_Names.store(name);
+        store.m_Names.store(key);
+        int id = m_SharedIds ? m_SharedIds->fetch_add(1, std::memory_order_relaxed) : m_NextId++;
+        store.m_Records.push_back(SRecord{offset, name.size(), key.size(), CFilter::fingerprint(key), born, enrolled, id});
+        if (slot % 64 == 0)
+            store.m_Dead.push_back(0);
+        store.m_Index.insert(slot);
+        store.m_ByName.insert(store.m_ByName.end(), slot);
+        store.addPostings(slot);
+        {
+            std::lock_guard cacheLock(m_CacheLock);
+            for (auto &[order, index] : m_Composite)
+                index->m_Rows.insert(slot);
+            trimComposite(0);
+        }
+        const SRecord &rec = store.m_Records.back();
+        updateCounts(rec, true);
+        if (m_Feed)
+            m_Feed->publish(true, rec.m_Id, name, born, enrolled);
+        if (!m_Views.empty()) {
+            CStudent student = materialize(rec);
+            for (auto &[id, view] : m_Views)
+                view.onAdd(student);
+        }
+        ++m_Generation;
+        return true;
+    }
+
+    bool delStudent(const CStudent &x) {
+        return delStudent(x.getName(), x.getDateOfBirth(), x.getEnrolledYear());
+    }
+
+    bool delStudent(std::string_view name, const CDate &born, int enrolled) {
+        CStatsTimer timer(*this, EStatOp::DEL);
+        std::unique_lock lock(m_Lock);
+        SStore &store = *m_Store;
+        auto it = store.m_Index.find(SProbe{name, born, enrolled});
+        if (it == store.m_Index.end())
+            return false;
+        m_Frozen.reset();
+        size_t slot = *it;
+        const SRecord &rec = store.m_Records[slot];
+        if (!m_Views.empty()) {
+            CStudent student = materialize(rec);
+            for (auto &[id, view] : m_Views)
+                view.onDel(student);
+        }
+        updateCounts(rec, false);
+        if (m_Feed)
+            m_Feed->publish(false, rec.m_Id, this->name(rec), born, enrolled);
+        // the ordered indexes keep the slot, scans skip it until the next compaction
+        store.bury(slot);
+        ++m_Generation;
+        if (!m_CompactPending && store.m_DeadCount >= COMPACT_MIN && store.m_DeadCount > store.m_Records.size() * m_CompactRatio) {
+            m_CompactPending = true;
+            executor().post([this] { compactStore(); });
+        }
+        return true;
+    }
+
+    // rewrites records, names and indexes without the deleted slots, normally done in the background once the
+    // deleted fraction passes the threshold. Adds, deletes and queries go on meanwhile, only the final swap
+    // takes the exclusive lock
+    void compact() {
+        compactStore();
+    }
+
+    // read-mostly mode: the birth dates and enroll years are laid out in Eytzinger order next to the slots
+    // sorted by each, so a date or year range becomes a run of slots found in a few cache misses. Any
+    // add / del / clear thaws the department again
+    void freeze() {
+        std::unique_lock lock(m_Lock);
+        auto frozen = std::make_unique<SFrozen>();
+        const auto &records = m_Store->m_Records;
+        forEachLive([&](const SRecord &rec) {
+            frozen->m_ByBorn.push_back(static_cast<uint32_t>(&rec - records.data()));
+        });
+        frozen->m_ByEnrolled = frozen->m_ByBorn;
+        std::stable_sort(frozen->m_ByBorn.begin(), frozen->m_ByBorn.end(), [&records](uint32_t a, uint32_t b) {
+            return records[a].m_Born < records[b].m_Born;
+        });
+        std::stable_sort(frozen->m_ByEnrolled.begin(), frozen->m_ByEnrolled.end(), [&records](uint32_t a, uint32_t b) {
+            return records[a].m_Enrolled < records[b].m_Enrolled;
+        });
+        frozen->m_Born = CEytzinger<CDate>(std::vector<std::pair<CDate, size_t>>(m_BirthCount.begin(), m_BirthCount.end()));
+        frozen->m_Enrolled = CEytzinger<int>(std::vector<std::pair<int, size_t>>(m_EnrollCount.begin(), m_EnrollCount.end()));
+        m_Frozen = std::move(frozen);
+    }
+
+    bool frozen() const {
+        std::shared_lock lock(m_Lock);
+        return m_Frozen != nullptr;
+    }
+
+    void setCompactThreshold(double ratio) {
+        std::unique_lock lock(m_Lock);
+        m_CompactRatio = ratio;
+    }
+
+    size_t tombstones() const {
+        std::shared_lock lock(m_Lock);
+        return m_Store->m_DeadCount;
+    }
+
+    bool contains(const CStudent &x) const {
+        return contains(x.getName(), x.getDateOfBirth(), x.getEnrolledYear());
+    }
+
+    bool contains(std::string_view name, const CDate &born, int enrolled) const {
+        std::shared_lock lock(m_Lock);
+        return m_Store->m_Index.find(SProbe{name, born, enrolled}) != m_Store->m_Index.end();
+    }
+
+    // memory the composite sort indexes may take, least recently used ones go first when it runs out
+    void setIndexBudget(size_t bytes) {
+        std::lock_guard lock(m_CacheLock);
+        m_IndexBudget = bytes;
+        trimComposite(0);
+    }
+
+    size_t compositeIndexes() const {
+        std::lock_guard lock(m_CacheLock);
+        return m_Composite.size();
+    }
+
+    // drops every student, the store's pool goes back to the memory resource in a few large blocks (the
+    // counters, caches and views free theirs one by one); views stay open and report their rows as removed
+    void clear() {
+        std::unique_lock lock(m_Lock);
+        if (m_Feed)
+            forEachLive([this](const SRecord &rec) {
+                m_Feed->publish(false, rec.m_Id, name(rec), rec.m_Born, rec.m_Enrolled);
+            });
+        m_Frozen.reset();
+        {
+            std::lock_guard cacheLock(m_CacheLock);
+            m_Composite.clear();
+        }
+        m_Store = std::make_unique<SStore>(m_Resource);
+        ++m_StoreEpoch;
+        m_CompactPending = false;
+        m_EnrollCount.clear();
+        m_BirthCount.clear();
+        m_NameEnrollCount.clear();
+        for (auto &[id, view] : m_Views)
+            view.onClear();
+        ++m_Generation;
+    }
+
+
+    std::list<CStudent> search(const CFilter &flt, const CSort &sortOpt) const {
+        std::shared_lock lock(m_Lock);
+        return searchWith(flt, sortOpt, sortOpt);
+    }
+
+    template <typename ... Keys_>
+    std::list<CStudent> search(const CFilter &flt, const CStaticSort<Keys_...> &sortOpt) const {
+        std::shared_lock lock(m_Lock);
+        return searchWith(flt, sortOpt.dynamic(), sortOpt);
+    }
+
+    // runs the query the way search would, bypassing the result cache and without counting towards composite
+    // indexes, and reports the path it took; costs one search plus a clock read per stage
+    SQueryPlan explain(const CFilter &flt, const CSort &sortOpt) const {
+        std::shared_lock lock(m_Lock);
+        SQueryPlan plan;
+        searchWith(flt, sortOpt, sortOpt, nullptr, &plan);
+        return plan;
+    }
+
+    std::set<std::string> suggest(const std::string &name) const {
+        std::shared_lock lock(m_Lock);
+        return suggestWith(name, nullptr);
+    }
+
+    // at most `limit` distinct names holding every query token, best match first: names with fewer tokens
+    // beyond the query rank higher, then by name. A bounded heap keeps only the best `limit` names seen
+    std::vector<std::string> suggest(const std::string &name, size_t limit) const {
+        CStatsTimer timer(*this, EStatOp::SUGGEST);
+        auto query = CFilter::splitToLower(name);
+        std::sort(query.begin(), query.end());
+        query.erase(std::unique(query.begin(), query.end()), query.end());
+        std::shared_lock lock(m_Lock);
+        if (query.empty() || limit == 0)
+            return {};
+
+        using TRank = std::pair<size_t, std::string_view>;
+        std::vector<TRank> heap;
+        std::unordered_set<std::string_view> inHeap;
+        size_t scanned = 0;
+        CPostingList::intersect(postingsFor(query), [&](uint32_t slot) {
+            ++scanned;
+            if (dead(slot))
+                return;
+            const SRecord &rec = m_Store->m_Records[slot];
+            std::string_view folded = foldedName(rec);
+            size_t extra = std::count(folded.begin(), folded.end(), ' ') + 1 - query.size();
+            if (heap.size() == limit && extra > heap.front().first)
+                return;
+            TRank rank{extra, this->name(rec)};
+            if (inHeap.count(rank.second) || (heap.size() == limit && !(rank < heap.front())))
+                return;
+            if (heap.size() == limit) {
+                std::pop_heap(heap.begin(), heap.end());
+                inHeap.erase(heap.back().second);
+                heap.pop_back();
+            }
+            heap.push_back(rank);
+            std::push_heap(heap.begin(), heap.end());
+            inHeap.insert(rank.second);
+        }, nullptr);
+
+        std::sort_heap(heap.begin(), heap.end());
+        std::vector<std::string> res;
+        for (const auto &[extra, student] : heap)
+            res.emplace_back(student);
+        stat(EStat::ROWS_SCANNED, scanned);
+        stat(EStat::ROWS_RETURNED, res.size());
+        return res;
+    }
+
+    // matching students written to `fd` in search order. The rows are copied out under the shared lock and
+    // written after it is released, so a slow reader of `fd` holds up no writer. Returns the number of rows
+    size_t exportTo(int fd, const CFilter &flt, const CSort &sortOpt, EExportFormat format = EExportFormat::CSV) const {
+        struct SRow {
+            size_t m_NameOff;
+            size_t m_NameLen;
+            CDate m_Born;
+            int m_Enrolled;
+        };
+        std::string names;
+        std::vector<SRow> rows;
+        {
+            std::shared_lock lock(m_Lock);
+            auto copy = [&](const SRecord &rec) {
+                std::string_view text = name(rec);
+                rows.push_back(SRow{names.size(), text.size(), rec.m_Born, rec.m_Enrolled});
+                names.append(text);
+            };
+            if (sortOpt.isEmpty()) {
+                forEachLive([&](const SRecord &rec) {
+                    if (flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                        copy(rec);
+                });
+            } else {
+                std::vector<size_t> slots;
+                forEachLive([&](const SRecord &rec) {
+                    if (flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                        slots.push_back(&rec - m_Store->m_Records.data());
+                });
+                std::sort(slots.begin(), slots.end(), CRecordOrder{m_Store.get(), sortOpt.keys()});
+                for (size_t slot : slots)
+                    copy(m_Store->m_Records[slot]);
+            }
+        }
+
+        CExportWriter out(fd, format);
+        // dates repeat a lot in sorted and in real data, one remembered date saves most of the bisections
+        std::optional<CDate> lastDate;
+        std::array<int, 3> lastParts{};
+        for (const SRow &row : rows) {
+            if (!lastDate || *lastDate != row.m_Born) {
+                lastDate = row.m_Born;
+                lastParts = partsOf(row.m_Born);
+            }
+            out.row(std::string_view(names).substr(row.m_NameOff, row.m_NameLen), lastParts[0], lastParts[1],
+                    lastParts[2], row.m_Enrolled);
+        }
+        return out.finish();
+    }
+
+    // every thread's counters summed up; they keep counting while this reads them
+    SStudyStats stats() const {
+        SStudyStats res;
+        std::lock_guard lock(m_StatsLock);
+        for (const auto &[thread, slot] : m_ThreadStats) {
+            for (size_t op = 0; op < res.m_Latency.size(); ++op) {
+                CLatencyHistogram hist;
+                for (size_t i = 0; i < CLatencyHistogram::BUCKETS; ++i)
+                    hist.add(i, slot->m_Latency[op][i].get(), 0);
+                hist.add(0, 0, slot->m_LatencySum[op].get());
+                res.m_Latency[op].merge(hist);
+            }
+            for (size_t i = 0; i < res.m_Counters.size(); ++i)
+                res.m_Counters[i] += slot->m_Counters[i].get();
+        }
+        return res;
+    }
+
+    // names with a token sounding like each query token (same Soundex code), looked up in an index filled
+    // at insert time like the exact token postings
+    std::set<std::string> suggestPhonetic(const std::string &name) const {
+        CStatsTimer timer(*this, EStatOp::SUGGEST);
+        std::vector<uint32_t> query = phoneticKeys(CFilter::foldKey(name));
+        std::shared_lock lock(m_Lock);
+        std::set<std::string> res;
+        if (query.empty())
+            return res;
+        size_t scanned = 0;
+        CPostingList::intersect(postingsFor(m_Store->m_Phonetic, query), [&](uint32_t slot) {
+            ++scanned;
+            if (!dead(slot))
+                res.emplace(this->name(m_Store->m_Records[slot]));
+        }, nullptr);
+        stat(EStat::ROWS_SCANNED, scanned);
+        stat(EStat::ROWS_RETURNED, res.size());
+        return res;
+    }
+
+    // live students whose name holds `token`, after case folding
+    size_t tokenFrequency(const std::string &token) const {
+        std::string folded = CFilter::foldKey(token);
+        std::shared_lock lock(m_Lock);
+        auto it = m_Store->m_Postings.find(std::pmr::string(folded, m_Resource));
+        return it == m_Store->m_Postings.end() ? 0 : it->second.m_Students;
+    }
+
+    // runs on the department's worker threads, a stop request or a passed deadline ends the scan
+    // with CQueryCancelled stored in the future
+    std::future<std::list<CStudent>> searchAsync(const CFilter &flt, const CSort &sortOpt, std::stop_token stop = {},
+                                                 CCancel::TClock::time_point deadline = CCancel::TClock::time_point::max()) const {
+        return runAsync<std::list<CStudent>>(std::move(stop), deadline, [this, flt, sortOpt](const CCancel *cancel) {
+            return searchWith(flt, sortOpt, sortOpt, cancel);
+        });
+    }
+
+    std::future<std::set<std::string>> suggestAsync(const std::string &name, std::stop_token stop = {},
+                                                    CCancel::TClock::time_point deadline = CCancel::TClock::time_point::max()) const {
+        return runAsync<std::set<std::string>>(std::move(stop), deadline, [this, name](const CCancel *cancel) {
+            return suggestWith(name, cancel);
+        });
+    }
+
+    // counts come straight from the per-year / per-date / per-name counters when they cover the filter
+    size_t count(const CFilter &flt) const {
+        std::shared_lock lock(m_Lock);
+        size_t res = 0;
+        if (auto range = frozenRange(flt)) {
+            auto [first, last] = std::pair(range->m_First, range->m_Last);
+            bool bothBounds = (flt.m_BornBefore || flt.m_BornAfter) && (flt.m_EnrolledBefore || flt.m_EnrolledAfter);
+            if (flt.m_Names.empty() && !bothBounds)
+                return last - first;
+            for (; first != last; ++first) {
+                const SRecord &rec = m_Store->m_Records[*first];
+                res += flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled);
+            }
+        } else if (!flt.indexable())
+            forEachLive([&](const SRecord &rec) { res += flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled); });
+        else if (!flt.m_BornBefore && !flt.m_BornAfter)
+            forEachEnrollBucket(flt, [&res](int, size_t cnt) { res += cnt; });
+        else if (flt.m_Names.empty() && !flt.m_EnrolledBefore && !flt.m_EnrolledAfter)
+            forRange(m_BirthCount, flt.m_BornAfter, flt.m_BornBefore, [&res](const CDate &, size_t cnt) { res += cnt; });
+        else
+            forEachLive([&](const SRecord &rec) { res += flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled); });
+        return res;
+    }
+
+    // matching students grouped by enroll year or by year of birth
+    std::map<int, size_t> histogram(const CFilter &flt, ESortKey key) const {
+        if (key == ESortKey::NAME)
+            throw std::invalid_argument("Histogram needs a numeric key.\n");
+        std::shared_lock lock(m_Lock);
+
+        std::map<int, size_t> res;
+        if (key == ESortKey::ENROLL_YEAR && flt.indexable() && !flt.m_BornBefore && !flt.m_BornAfter) {
+            forEachEnrollBucket(flt, [&res](int year, size_t cnt) { res[year] += cnt; });
+            return res;
+        }
+        if (key == ESortKey::BIRTH_DATE && flt.indexable() && flt.m_Names.empty() && !flt.m_EnrolledBefore && !flt.m_EnrolledAfter) {
+            int year = 0;
+            std::optional<CDate> bucketEnd;
+            forRange(m_BirthCount, flt.m_BornAfter, flt.m_BornBefore, [&](const CDate &date, size_t cnt) {
+                if (!bucketEnd || !(date < *bucketEnd)) {
+                    year = yearOf(date);
+                    bucketEnd = year < INT_MAX ? CDate(year + 1, INT_MIN, INT_MIN) : CDate(INT_MAX, INT_MAX, INT_MAX);
+                }
+                res[year] += cnt;
+            });
+            return res;
+        }
+        forEachLive([&](const SRecord &rec) {
+            if (flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                ++res[key == ESortKey::ENROLL_YEAR ? rec.m_Enrolled : yearOf(rec.m_Born)];
+        });
+        return res;
+    }
+
+    // every later add / del reaches the subscriber in order. All subscribers read one ring: without a capacity
+    // the call joins the ring as it is (4096 slots if it is the first), with one it throws invalid_argument
+    // when the ring already has another size
+    CFeedSubscriber subscribe() {
+        std::unique_lock lock(m_Lock);
+        if (!m_Feed)
+            m_Feed = std::make_shared<CChangeFeed>(FEED_SLOTS);
+        return CFeedSubscriber(m_Feed);
+    }
+
+    CFeedSubscriber subscribe(size_t capacity) {
+        std::unique_lock lock(m_Lock);
+        if (!m_Feed)
+            m_Feed = std::make_shared<CChangeFeed>(capacity);
+        else if (m_Feed->capacity() != CChangeFeed::slotsFor(capacity))
+            throw std::invalid_argument("Change feed already has a ring of another size.\n");
+        return CFeedSubscriber(m_Feed);
+    }
+
+    // a view keeps at most `maxChanges` changes nobody has taken, older ones are dropped and counted
+    size_t addView(const CFilter &flt, const CSort &sortOpt, size_t maxChanges = 4096) {
+        std::unique_lock lock(m_Lock);
+        size_t id = m_NextViewId++;
+        auto &view = m_Views.emplace(id, CStudyView(flt, sortOpt, maxChanges)).first->second;
+        forEachLive([&](const SRecord &rec) {
+            if (flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                view.m_Rows.insert(materialize(rec));
+        });
+        return id;
+    }
+
+    // copy of the view's rows and pending changes as of now, writers may go on meanwhile
+    CStudyView view(size_t id) const {
+        std::shared_lock lock(m_Lock);
+        return m_Views.at(id);
+    }
+
+    // the view's pending changes, in mutation order; they are not reported again
+    std::vector<SViewChange> takeChanges(size_t id) {
+        std::unique_lock lock(m_Lock);
+        return m_Views.at(id).take();
+    }
+
+    bool dropView(size_t id) {
+        std::unique_lock lock(m_Lock);
+        return m_Views.erase(id) > 0;
+    }
+
+
+private:
+    friend class CShardedStudyDept;
+
+    struct SProbe {
+        std::string_view m_Name;
+        const CDate &m_Born;
+        int m_Enrolled;
+    };
+
+    struct SStore;
+
+    // identity hashing over records, also accepts a probe so lookups need no record nor string
+    struct CIdentityBase {
+        using is_transparent = void;
+        const SStore *m_Store;
+
+        SProbe probe(size_t slot) const {
+            const SRecord &rec = m_Store->m_Records[slot];
+            return SProbe{m_Store->name(rec), rec.m_Born, rec.m_Enrolled};
+        }
+
+        static const SProbe &probe(const SProbe &p) {
+            return p;
+        }
+    };
+
+    // the whole identity: CDate has no accessors but is trivially copyable, its bytes stand in for its fields,
+    // the same way the change feed ships it
+    static uint64_t identityHash(std::string_view name, const CDate &born, int enrolled) {
+        static_assert(std::is_trivially_copyable_v<CDate> && sizeof(CDate) <= 2 * sizeof(uint64_t));
+        uint64_t date[2] = {};
+        std::memcpy(date, &born, sizeof(CDate));
+        uint64_t h = std::hash<std::string_view>()(name);
+        for (uint64_t word : {date[0], date[1], uint64_t(uint32_t(enrolled))})
+            h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        return h ^ h >> 29;
+    }
+
+    struct CIdentityHash : CIdentityBase {
+        template <typename T_>
+        size_t operator()(const T_ &x) const {
+            const SProbe &p = probe(x);
+            return identityHash(p.m_Name, p.m_Born, p.m_Enrolled);
+        }
+    };
+
+    struct CIdentityEqual : CIdentityBase {
+        template <typename A_, typename B_>
+        bool operator()(const A_ &a, const B_ &b) const {
+            const SProbe &pa = probe(a), &pb = probe(b);
+            return pa.m_Enrolled == pb.m_Enrolled && pa.m_Born == pb.m_Born && pa.m_Name == pb.m_Name;
+        }
+    };
+
+    // (name, insertion order) so a plain NAME sort is the index order itself, equal names keep insertion order
+    struct CNameOrder {
+        const SStore *m_Store;
+
+        bool operator()(size_t x, size_t y) const {
+            const SRecord &a = m_Store->m_Records[x], &b = m_Store->m_Records[y];
+            if (auto cmp = m_Store->name(a).compare(m_Store->name(b)); cmp != 0)
+                return cmp < 0;
+            return a.m_Id < b.m_Id;
+        }
+    };
+
+    // full sort order over records: the sort keys, then insertion order
+    struct CRecordOrder {
+        const SStore *m_Store;
+        std::vector<std::pair<ESortKey, bool>> m_Keys;
+
+        bool operator()(size_t x, size_t y) const {
+            const SRecord &a = m_Store->m_Records[x], &b = m_Store->m_Records[y];
+            for (const auto &[key, asc] : m_Keys) {
+                int cmp = 0;
+                switch (key) {
+                    case ESortKey::NAME:
+                        cmp = m_Store->name(a).compare(m_Store->name(b));
+                        break;
+                    case ESortKey::BIRTH_DATE:
+                        cmp = a.m_Born < b.m_Born ? -1 : (b.m_Born < a.m_Born ? 1 : 0);
+                        break;
+                    case ESortKey::ENROLL_YEAR:
+                        cmp = (a.m_Enrolled > b.m_Enrolled) - (a.m_Enrolled < b.m_Enrolled);
+                        break;
+                }
+                if (cmp != 0)
+                    return asc ? cmp < 0 : cmp > 0;
+            }
+            return a.m_Id < b.m_Id;
+        }
+    };
+
+    static constexpr bool STATS = STUDYDEPT_STATS;
+
+    // one thread's share of the statistics, only that thread writes it
+    struct SThreadStats {
+        std::array<std::array<CStatCounter, CLatencyHistogram::BUCKETS>, 4> m_Latency;
+        std::array<CStatCounter, 4> m_LatencySum;
+        std::array<CStatCounter, 10> m_Counters;
+    };
+
+    // the calling thread's share: a small per-thread table keyed by department serial, the department's own
+    // map only on a miss. Serials are never reused, so an entry of a destroyed department never matches
+    SThreadStats &threadStats() const {
+        struct SEntry {
+            uint64_t m_Serial = 0;
+            SThreadStats *m_Stats = nullptr;
+        };
+        static thread_local std::array<SEntry, 8> recent;
+        SEntry &entry = recent[m_Serial % recent.size()];
+        if (entry.m_Serial != m_Serial) {
+            std::lock_guard lock(m_StatsLock);
+            auto &slot = m_ThreadStats[std::this_thread::get_id()];
+            if (!slot)
+                slot = std::make_unique<SThreadStats>();
+            entry = SEntry{m_Serial, slot.get()};
+        }
+        return *entry.m_Stats;
+    }
+
+    void stat(EStat stat, uint64_t n = 1) const {
+        if constexpr (STATS)
+            threadStats().m_Counters[static_cast<size_t>(stat)].add(n);
+    }
+
+    // records the latency of one operation when it goes out of scope
+    class CStatsTimer {
+    public:
+        CStatsTimer(const CStudyDept &dept, EStatOp op, bool enabled = true)
+                : m_Dept(dept), m_Op(static_cast<size_t>(op)), m_Enabled(enabled) {
+            if constexpr (STATS)
+                m_Start = std::chrono::steady_clock::now();
+        }
+
+        ~CStatsTimer() {
+            if constexpr (STATS) {
+                if (!m_Enabled)
+                    return;
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+                SThreadStats &stats = m_Dept.threadStats();
+                stats.m_Latency[m_Op][CLatencyHistogram::bucketOf(static_cast<uint64_t>(ns))].add();
+                stats.m_LatencySum[m_Op].add(static_cast<uint64_t>(ns));
+            }
+        }
+
+        CStatsTimer(const CStatsTimer &) = delete;
+        CStatsTimer &operator=(const CStatsTimer &) = delete;
+
+    private:
+        const CStudyDept &m_Dept;
+        size_t m_Op;
+        bool m_Enabled;
+        std::chrono::steady_clock::time_point m_Start;
+    };
+
+    static uint64_t nextSerial() {
+        static std::atomic<uint64_t> serial{1};
+        return serial.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct SFrozen {
+        CEytzinger<CDate> m_Born;
+        CEytzinger<int> m_Enrolled;
+        // live slots ordered by birth date / enroll year, ties in slot order
+        std::vector<uint32_t> m_ByBorn;
+        std::vector<uint32_t> m_ByEnrolled;
+    };
+
+    struct STokenPostings {
+        CPostingList m_Slots;
+        // live students holding the token, the list itself still has the deleted ones
+        size_t m_Students = 0;
+    };
+
+    // everything addressed by slot: records, their name bytes, tombstones and the indexes over slots. The
+    // functors of the indexes point at the store, so compaction builds a renumbered store off the lock and
+    // swaps the pointer; neither may be copied or moved
+    // every allocation of a store comes from a pool it owns over the department's resource: nodes freed one by
+    // one only go back to the pool, dropping the whole store hands its chunks upstream in a few large blocks.
+    // The pool is unsynchronized, a store allocates only under the exclusive lock or while one compaction
+    // builds it alone
+    struct SStore {
+        explicit SStore(std::pmr::memory_resource *upstream)
+                : m_Pool(upstream), m_Resource(&m_Pool), m_Names(m_Resource), m_Records(m_Resource), m_Dead(m_Resource),
+                  m_Index(0, CIdentityHash{this}, CIdentityEqual{this}, m_Resource),
+                  m_ByName(CNameOrder{this}, m_Resource), m_Postings(m_Resource), m_Phonetic(m_Resource) {}
+
+        SStore(const SStore &) = delete;
+        SStore &operator=(const SStore &) = delete;
+
+        std::string_view name(const SRecord &rec) const {
+            return m_Names.get(rec.m_NameOff, rec.m_NameLen);
+        }
+
+        std::string_view foldedName(const SRecord &rec) const {
+            return m_Names.get(rec.m_NameOff + rec.m_NameLen, rec.m_KeyLen);
+        }
+
+        bool dead(size_t slot) const {
+            return m_Dead[slot / 64] >> (slot % 64) & 1;
+        }
+
+        // copies a record with its name bytes from another store into the next slot, no index is touched
+        size_t append(const SStore &from, const SRecord &rec) {
+            size_t slot = m_Records.size();
+            m_Records.push_back(rec);
+            m_Records.back().m_NameOff = m_Names.store(from.name(rec));
+            m_Names.store(from.foldedName(rec));
+            if (slot % 64 == 0)
+                m_Dead.push_back(0);
+            return slot;
+        }
+
+        // tombstones a slot the identity index and the token counts still hold
+        void bury(size_t slot) {
+            m_Index.erase(slot);
+            forgetPostings(slot);
+            m_Dead[slot / 64] |= uint64_t(1) << (slot % 64);
+            ++m_DeadCount;
+        }
+
+        // slots only ever grow within a list; deleted ones stay listed until compaction rebuilds the lists
+        void addPostings(size_t slot) {
+            std::string_view folded = foldedName(m_Records[slot]);
+            forEachToken(folded, [&](std::string_view token) {
+                auto &entry = m_Postings.try_emplace(std::pmr::string(token, m_Resource)).first->second;
+                entry.m_Slots.append(static_cast<uint32_t>(slot));
+                ++entry.m_Students;
+            });
+            for (uint32_t code : phoneticKeys(folded)) {
+                auto &entry = m_Phonetic[code];
+                entry.m_Slots.append(static_cast<uint32_t>(slot));
+                ++entry.m_Students;
+            }
+        }
+
+        void forgetPostings(size_t slot) {
+            std::string_view folded = foldedName(m_Records[slot]);
+            forEachToken(folded, [&](std::string_view token) {
+                --m_Postings.find(std::pmr::string(token, m_Resource))->second.m_Students;
+            });
+            for (uint32_t code : phoneticKeys(folded))
+                --m_Phonetic.find(code)->second.m_Students;
+        }
+
+        // declared first, so it outlives every container it serves
+        std::pmr::unsynchronized_pool_resource m_Pool;
+        std::pmr::memory_resource *m_Resource;
+        CNameArena m_Names;
+        // slots in insertion order, deleted ones stay in place with their bit set in m_Dead
+        std::pmr::vector<SRecord> m_Records;
+        std::pmr::vector<uint64_t> m_Dead;
+        size_t m_DeadCount = 0;
+        std::pmr::unordered_set<size_t, CIdentityHash, CIdentityEqual> m_Index;
+        std::pmr::set<size_t, CNameOrder> m_ByName;
+        // folded name token -> slots of the students holding it
+        std::pmr::unordered_map<std::pmr::string, STokenPostings> m_Postings;
+        // Soundex code -> slots of the students with a token of that code
+        std::pmr::unordered_map<uint32_t, STokenPostings> m_Phonetic;
+    };
+
+    struct SComposite {
+        std::pmr::set<size_t, CRecordOrder> m_Rows;
+        size_t m_LastUse;
+    };
+
+    // run of frozen slots a date or year bound selects
+    struct SFrozenRange {
+        const uint32_t *m_First;
+        const uint32_t *m_Last;
+        // birth dates drive it, otherwise enroll years
+        bool m_Born;
+
+        size_t size() const {
+            return static_cast<size_t>(m_Last - m_First);
+        }
+    };
+
+    enum class EAccess {
+        FULL_SCAN,
+        FROZEN_RANGE,
+        NAME_INDEX,
+        COMPOSITE
+    };
+
+    struct SAccessPlan {
+        EAccess m_Path = EAccess::FULL_SCAN;
+        std::optional<SFrozenRange> m_Range;
+        size_t m_Live = 0;
+        size_t m_Estimated = 0;
+        // rough work of the chosen path, see scanCost / walkCost
+        size_t m_Cost = 0;
+
+        // the SQueryPlan::m_Access name
+        const char *label() const {
+            switch (m_Path) {
+                case EAccess::FROZEN_RANGE:
+                    return m_Range->m_Born ? "frozen birth dates" : "frozen enroll years";
+                case EAccess::NAME_INDEX:
+                    return "name index";
+                case EAccess::COMPOSITE:
+                    return "composite index";
+                default:
+                    return "full scan";
+            }
+        }
+    };
+
+    struct SSortUsage {
+        size_t m_Count = 0;
+        size_t m_LastUse = 0;
+        // an index for the order is being built in the background
+        bool m_Building = false;
+    };
+
+    // change feed ring of a subscribe() without a capacity
+    static constexpr size_t FEED_SLOTS = 4096;
+    // students (or suggested names) each result cache may hold across all its entries
+    static constexpr size_t CACHE_ROWS = 1 << 16;
+    // searches with the same sort order this many times get an index for it
+    static constexpr size_t COMPOSITE_AFTER = 3;
+    // rough bytes per indexed record: a tree node holding one slot
+    static constexpr size_t COMPOSITE_NODE = sizeof(size_t) + 4 * sizeof(void *);
+    // background compaction starts once at least this many slots are deleted
+    static constexpr size_t COMPACT_MIN = 1024;
+    // an ordered index walk chases one tree node per row, counted as this many rows of a sequential scan
+    static constexpr size_t WALK_COST = 4;
+
+    // rough work of an access path in scanned rows: a walk of an ordered index needs no sort, a scan of the
+    // store or of a frozen range reads its rows and then sorts what matched
+    static size_t walkCost(size_t rows) {
+        return rows * WALK_COST;
+    }
+
+    static size_t scanCost(size_t rows, size_t matches, bool sorted) {
+        return rows + (sorted ? matches * std::bit_width(matches) : 0);
+    }
+
+    size_t compositeBytes() const {
+        size_t res = 0;
+        for (const auto &[order, index] : m_Composite)
+            res += index->m_Rows.size() * COMPOSITE_NODE;
+        return res;
+    }
+
+    // evicts least recently used indexes until `extra` more bytes fit into the budget
+    void trimComposite(size_t extra) const {
+        while (!m_Composite.empty() && compositeBytes() + extra > m_IndexBudget) {
+            auto victim = std::min_element(m_Composite.begin(), m_Composite.end(), [](const auto &a, const auto &b) {
+                return a.second->m_LastUse < b.second->m_LastUse;
+            });
+            m_Composite.erase(victim);
+        }
+    }
+
+    // records the use of a sort order and returns its index if there is one, an order that has just become hot
+    // enough gets its index built on the executor. Called with m_CacheLock held, the returned index stays alive
+    // even if it is evicted meanwhile
+    std::shared_ptr<const SComposite> compositeFor(const CSort &sortOpt) const {
+        if (sortOpt.isEmpty())
+            return nullptr;
+        std::string order = sortOpt.key();
+        auto &usage = m_SortUsage[order];
+        ++usage.m_Count;
+        usage.m_LastUse = ++m_UseClock;
+        if (auto it = m_Composite.find(order); it != m_Composite.end()) {
+            it->second->m_LastUse = m_UseClock;
+            return it->second;
+        }
+
+        size_t cost = (m_Store->m_Records.size() - m_Store->m_DeadCount) * COMPOSITE_NODE;
+        if (usage.m_Count < COMPOSITE_AFTER || usage.m_Building || cost > m_IndexBudget)
+            return nullptr;
+        usage.m_Building = true;
+        executor().post([this, order, keys = sortOpt.keys()] { buildComposite(order, keys); });
+        return nullptr;
+    }
+
+    // fills the index under the shared lock only, so writers wait for it but neither queries nor the caches do;
+    // no row can be added before it is published
+    void buildComposite(const std::string &order, const std::vector<std::pair<ESortKey, bool>> &keys) const {
+        std::shared_lock lock(m_Lock);
+        auto index = std::make_shared<SComposite>(SComposite{
+                std::pmr::set<size_t, CRecordOrder>(CRecordOrder{m_Store.get(), keys}, m_Resource), 0});
+        forEachLive([&](const SRecord &rec) { index->m_Rows.insert(&rec - m_Store->m_Records.data()); });
+
+        std::lock_guard cacheLock(m_CacheLock);
+        m_SortUsage[order].m_Building = false;
+        size_t cost = index->m_Rows.size() * COMPOSITE_NODE;
+        if (cost > m_IndexBudget || m_Composite.count(order))
+            return;
+        trimComposite(cost);
+        index->m_LastUse = ++m_UseClock;
+        m_Composite.emplace(order, std::move(index));
+    }
+
+    // the index for a sort order if there is one, without recording a use; called with m_CacheLock held
+    std::shared_ptr<const SComposite> existingComposite(const CSort &sortOpt) const {
+        if (sortOpt.isEmpty())
+            return nullptr;
+        auto it = m_Composite.find(sortOpt.key());
+        return it == m_Composite.end() ? nullptr : it->second;
+    }
+
+    // upper bound on the students matching an indexable filter, from the counters alone: the year / date counts
+    // and the rarest token of each filter name. Expression filters are not estimated. A frozen department
+    // counts its narrowest range in a few lookups instead of walking the counts
+    size_t estimateRows(const CFilter &flt) const {
+        size_t res = m_Store->m_Records.size() - m_Store->m_DeadCount;
+        if (!flt.indexable())
+            return res;
+        if (auto range = frozenRange(flt)) {
+            res = std::min(res, range->size());
+        } else {
+            if (flt.m_EnrolledAfter || flt.m_EnrolledBefore) {
+                size_t years = 0;
+                forRange(m_EnrollCount, flt.m_EnrolledAfter, flt.m_EnrolledBefore, [&years](int, size_t cnt) { years += cnt; });
+                res = std::min(res, years);
+            }
+            if (flt.m_BornAfter || flt.m_BornBefore) {
+                size_t dates = 0;
+                forRange(m_BirthCount, flt.m_BornAfter, flt.m_BornBefore, [&dates](const CDate &, size_t cnt) { dates += cnt; });
+                res = std::min(res, dates);
+            }
+        }
+        if (!flt.m_NameKeys.empty()) {
+            size_t names = 0;
+            for (const auto &key : std::set<std::string>(flt.m_NameKeys.begin(), flt.m_NameKeys.end())) {
+                size_t rarest = res;
+                forEachToken(key, [&](std::string_view token) {
+                    auto it = m_Store->m_Postings.find(std::pmr::string(token, m_Resource));
+                    rarest = std::min(rarest, it == m_Store->m_Postings.end() ? 0 : it->second.m_Students);
+                });
+                names += rarest;
+            }
+            res = std::min(res, names);
+        }
+        return res;
+    }
+
+    template <typename T_, typename F_>
+    std::future<T_> runAsync(std::stop_token stop, CCancel::TClock::time_point deadline, F_ query) const {
+        auto promise = std::make_shared<std::promise<T_>>();
+        auto res = promise->get_future();
+        executor().post([this, promise, query, stop = std::move(stop), deadline] {
+            try {
+                CCancel cancel(stop, deadline);
+                cancel.check();
+                std::shared_lock lock(m_Lock);
+                promise->set_value(query(&cancel));
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return res;
+    }
+
+    CExecutor &executor() const {
+        std::call_once(m_ExecutorOnce, [this] {
+            m_Executor = std::make_unique<CExecutor>(std::thread::hardware_concurrency());
+        });
+        return *m_Executor;
+    }
+
+    std::set<std::string> suggestWith(const std::string &name, const CCancel *cancel) const {
+        CStatsTimer timer(*this, EStatOp::SUGGEST);
+        auto query = CFilter::splitToLower(name);
+        std::sort(query.begin(), query.end());
+        query.erase(std::unique(query.begin(), query.end()), query.end());
+        if (query.empty())
+            return {};
+
+        std::string key = CFilter::joinTokens(query);
+        {
+            std::lock_guard cacheLock(m_CacheLock);
+            if (const auto *hit = m_SuggestCache.find(key, m_Generation)) {
+                stat(EStat::SUGGEST_CACHE_HIT);
+                return *hit;
+            }
+        }
+        stat(EStat::SUGGEST_CACHE_MISS);
+
+        // students holding every query token
+        std::set<std::string> res;
+        size_t scanned = 0;
+        CPostingList::intersect(postingsFor(query), [&](uint32_t slot) {
+            ++scanned;
+            if (!dead(slot))
+                res.emplace(this->name(m_Store->m_Records[slot]));
+        }, cancel);
+        stat(EStat::ROWS_SCANNED, scanned);
+        stat(EStat::ROWS_RETURNED, res.size());
+        std::lock_guard cacheLock(m_CacheLock);
+        m_SuggestCache.insert(key, m_Generation, res);
+        return res;
+    }
+
+    // `sortOpt` drives the cache and the index choice, `cmp` is the comparator used for whatever is left to sort
+    template <typename C_>
+    std::list<CStudent> searchWith(const CFilter &flt, const CSort &sortOpt, const C_ &cmp,
+                                   const CCancel *cancel = nullptr, SQueryPlan *explain = nullptr) const {
+        // explain leaves the statistics alone, it is not a search the application made
+        CStatsTimer timer(*this, EStatOp::SEARCH, !explain);
+        auto record = [explain, this](EStat what, uint64_t n = 1) {
+            if (!explain)
+                stat(what, n);
+        };
+        CPlanRecorder plan(explain);
+        bool nameLed = !sortOpt.isEmpty() && sortOpt.keys().front().first == ESortKey::NAME;
+        std::string key = flt.key() + '#' + sortOpt.key();
+        std::shared_ptr<const SComposite> index;
+        {
+            std::lock_guard cacheLock(m_CacheLock);
+            if (plan) {
+                plan->m_Cached = m_SearchCache.contains(key, m_Generation);
+                index = nameLed ? nullptr : existingComposite(sortOpt);
+            } else {
+                if (const auto *hit = m_SearchCache.find(key, m_Generation)) {
+                    stat(EStat::SEARCH_CACHE_HIT);
+                    return *hit;
+                }
+                if (!nameLed)
+                    index = compositeFor(sortOpt);
+            }
+        }
+
+        record(EStat::SEARCH_CACHE_MISS);
+        SAccessPlan access = planAccess(flt, sortOpt, index.get(), static_cast<bool>(plan));
+        size_t live = access.m_Live, estimated = access.m_Estimated;
+        // the estimate stage gets the actual number of results once they are known
+        plan.stage("estimate", live, estimated, 0);
+        if (plan)
+            plan->m_Access = access.label();
+
+        // every path visits all rows of the structure it walks
+        std::list<CStudent> res;
+        size_t rows = 0;
+        if (access.m_Path == EAccess::NAME_INDEX) {
+            record(EStat::NAME_INDEX);
+            record(EStat::ROWS_SCANNED, m_Store->m_ByName.size());
+            std::chrono::nanoseconds runSort{0};
+            res = searchByName(flt, sortOpt, cmp, cancel, plan ? &runSort : nullptr);
+            if (plan) {
+                plan->m_SortNeeded = std::any_of(sortOpt.keys().begin(), sortOpt.keys().end(),
+                                                 [](const auto &k) { return k.first != ESortKey::NAME; });
+                plan.stage("scan", m_Store->m_ByName.size(), estimated, res.size(), runSort);
+                if (plan->m_SortNeeded)
+                    plan->m_Stages.push_back(SPlanStage{"sort within equal names", res.size(), estimated, res.size(), runSort});
+            }
+        } else if (access.m_Path == EAccess::FROZEN_RANGE) {
+            size_t ranged = access.m_Range->size();
+            record(EStat::FROZEN_INDEX);
+            record(EStat::ROWS_SCANNED, ranged);
+            if (plan) {
+                plan->m_SortNeeded = !sortOpt.isEmpty();
+                plan.stage("range lookup", live, ranged, ranged);
+            }
+            // back to slot order first, so the sort keeps insertion order among ties
+            std::vector<uint32_t> hits;
+            for (const uint32_t *first = access.m_Range->m_First; first != access.m_Range->m_Last; ++first) {
+                CCancel::poll(cancel, rows);
+                const SRecord &rec = m_Store->m_Records[*first];
+                if (flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                    hits.push_back(*first);
+            }
+            std::sort(hits.begin(), hits.end());
+            for (uint32_t slot : hits)
+                res.push_back(materialize(m_Store->m_Records[slot]));
+            plan.stage("scan", ranged, estimated, res.size());
+            if (!sortOpt.isEmpty()) {
+                res.sort(cmp);
+                plan.stage("sort", res.size(), estimated, res.size());
+            }
+        } else if (access.m_Path == EAccess::COMPOSITE) {
+            record(EStat::COMPOSITE_INDEX);
+            record(EStat::ROWS_SCANNED, index->m_Rows.size());
+            for (size_t slot : index->m_Rows) {
+                CCancel::poll(cancel, rows);
+                const SRecord &rec = m_Store->m_Records[slot];
+                if (!dead(slot) && flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                    res.push_back(materialize(rec));
+            }
+            plan.stage("scan", index->m_Rows.size(), estimated, res.size());
+        } else {
+            record(EStat::FULL_SCAN);
+            record(EStat::ROWS_SCANNED, live);
+            forEachLive([&](const SRecord &rec) {
+                CCancel::poll(cancel, rows);
+                if (flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                    res.push_back(materialize(rec));
+            });
+            if (plan) {
+                plan->m_SortNeeded = !sortOpt.isEmpty();
+                plan.stage("scan", live, estimated, res.size());
+            }
+            if (!sortOpt.isEmpty()) {
+                res.sort(cmp);
+                plan.stage("sort", res.size(), estimated, res.size());
+            }
+        }
+        record(EStat::ROWS_RETURNED, res.size());
+        if (plan) {
+            plan->m_Stages.front().m_Actual = res.size();
+            return res;
+        }
+        std::lock_guard cacheLock(m_CacheLock);
+        m_SearchCache.insert(key, m_Generation, res);
+        return res;
+    }
+
+    // walks the name index run by run of equal names, only the later sort keys are left to order inside a run,
+    // when given, `runSort` collects the time spent ordering inside runs
+    template <typename C_>
+    std::list<CStudent> searchByName(const CFilter &flt, const CSort &sortOpt, const C_ &cmp, const CCancel *cancel,
+                                     std::chrono::nanoseconds *runSort) const {
+        bool asc = sortOpt.keys().front().second;
+        bool refine = std::any_of(sortOpt.keys().begin(), sortOpt.keys().end(),
+                                  [](const auto &k) { return k.first != ESortKey::NAME; });
+        std::list<CStudent> res;
+        size_t rows = 0;
+        auto emitRun = [&](auto first, auto last) {
+            std::list<CStudent> run;
+            for (; first != last; ++first) {
+                CCancel::poll(cancel, rows);
+                const SRecord &rec = m_Store->m_Records[*first];
+                if (!dead(*first) && flt.matchesKey(foldedName(rec), rec.m_NamePrint, rec.m_Born, rec.m_Enrolled))
+                    run.push_back(materialize(rec));
+            }
+            if (refine && runSort) {
+                auto start = std::chrono::steady_clock::now();
+                run.sort(cmp);
+                *runSort += std::chrono::steady_clock::now() - start;
+            } else if (refine)
+                run.sort(cmp);
+            res.splice(res.end(), run);
+        };
+
+        const auto &byName = m_Store->m_ByName;
+        const auto &records = m_Store->m_Records;
+        if (asc) {
+            for (auto first = byName.begin(); first != byName.end();) {
+                auto last = std::next(first);
+                while (last != byName.end() && name(records[*last]) == name(records[*first]))
+                    ++last;
+                emitRun(first, last);
+                first = last;
+            }
+        } else {
+            for (auto last = byName.end(); last != byName.begin();) {
+                auto first = std::prev(last);
+                while (first != byName.begin() && name(records[*std::prev(first)]) == name(records[*first]))
+                    --first;
+                emitRun(first, last);
+                last = first;
+            }
+        }
+        return res;
+    }
+
+    std::string_view name(const SRecord &rec) const {
+        return m_Store->name(rec);
+    }
+
+    std::string_view foldedName(const SRecord &rec) const {
+        return m_Store->foldedName(rec);
+    }
+
+    // distinct tokens of a folded key, which lists equal tokens next to each other
+    template <typename F_>
+    static void forEachToken(std::string_view folded, F_ fn) {
+        std::string_view prev;
+        for (size_t at = 0, end; at < folded.size(); at = end + 1) {
+            end = std::min(folded.find(' ', at), folded.size());
+            std::string_view token = folded.substr(at, end - at);
+            if (token != prev)
+                fn(token);
+            prev = token;
+        }
+    }
+
+    // slots within the filter's date or year bounds as a run of a frozen order, the shorter run when the
+    // filter has both; nothing when not frozen or when the filter has no such bound
+    std::optional<SFrozenRange> frozenRange(const CFilter &flt) const {
+        if (!m_Frozen || !flt.indexable())
+            return std::nullopt;
+        std::optional<SFrozenRange> res;
+        auto consider = [&res](const std::vector<uint32_t> &slots, size_t lo, size_t hi, bool born) {
+            hi = std::max(lo, hi);
+            if (!res || hi - lo < res->size())
+                res.emplace(SFrozenRange{slots.data() + lo, slots.data() + hi, born});
+        };
+        const SFrozen &f = *m_Frozen;
+        if (flt.m_BornAfter || flt.m_BornBefore)
+            consider(f.m_ByBorn, flt.m_BornAfter ? f.m_Born.countUpTo(*flt.m_BornAfter) : 0,
+                     flt.m_BornBefore ? f.m_Born.countBelow(*flt.m_BornBefore) : f.m_Born.total(), true);
+        if (flt.m_EnrolledAfter || flt.m_EnrolledBefore)
+            consider(f.m_ByEnrolled, flt.m_EnrolledAfter ? f.m_Enrolled.countUpTo(*flt.m_EnrolledAfter) : 0,
+                     flt.m_EnrolledBefore ? f.m_Enrolled.countBelow(*flt.m_EnrolledBefore) : f.m_Enrolled.total(), false);
+        return res;
+    }
+
+    // picks the access path of a search, searching and explaining both go through here so a plan shows what
+    // runs. The cheapest path wins: a selective filter is cheaper to scan and sort than to pick out of a whole
+    // ordered index, a narrow frozen range beats both, a wide one loses to an index that needs no sort.
+    // `index` is the composite index for the sort order, if any; the estimate is taken when a choice needs it
+    // or when `explaining`
+    SAccessPlan planAccess(const CFilter &flt, const CSort &sortOpt, const SComposite *index, bool explaining) const {
+        SAccessPlan res;
+        bool nameLed = !sortOpt.isEmpty() && sortOpt.keys().front().first == ESortKey::NAME;
+        bool sorted = !sortOpt.isEmpty();
+        res.m_Live = m_Store->m_Records.size() - m_Store->m_DeadCount;
+        res.m_Estimated = explaining || nameLed || index ? estimateRows(flt) : 0;
+        res.m_Range = frozenRange(flt);
+        res.m_Cost = scanCost(res.m_Live, res.m_Estimated, sorted);
+        auto consider = [&res](EAccess candidate, size_t cost) {
+            if (cost < res.m_Cost) {
+                res.m_Path = candidate;
+                res.m_Cost = cost;
+            }
+        };
+        if (res.m_Range)
+            consider(EAccess::FROZEN_RANGE, scanCost(res.m_Range->size(), std::min(res.m_Estimated, res.m_Range->size()), sorted));
+        if (nameLed)
+            consider(EAccess::NAME_INDEX, walkCost(m_Store->m_ByName.size()));
+        if (index)
+            consider(EAccess::COMPOSITE, walkCost(index->m_Rows.size()));
+        return res;
+    }
+
+    // Soundex code of the ASCII and Latin letters of a folded token packed into four bytes, 0 if the token has
+    // no such letter. Accented letters count as their base letter, Greek and Cyrillic ones are skipped
+    static uint32_t soundex(std::string_view token) {
+        static const char LATIN1[] = "aaaaaaaceeeeiiiidnooooo_ouuuuyty";
+        static const char LATIN_EXT_A[] = "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiiiiijjkkkllllllllllnnnnnnnnn"
+                                          "oooooooorrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+        static const char CODES[] = "01230120022455012623010202";
+        uint32_t res = 0;
+        size_t len = 0;
+        char last = 0;
+        for (size_t i = 0; i < token.size() && len < 4; ++i) {
+            auto ch = static_cast<unsigned char>(token[i]);
+            char letter = 0;
+            if (ch == 0xC3 && i + 1 < token.size()) {
+                auto cp = static_cast<unsigned char>(token[++i]) + 0x40;
+                letter = cp >= 0xE0 ? LATIN1[cp - 0xE0] : 0;
+            } else if ((ch == 0xC4 || ch == 0xC5) && i + 1 < token.size()) {
+                size_t cp = ((ch & 0x1F) << 6 | (static_cast<unsigned char>(token[++i]) & 0x3F)) - 0x100;
+                letter = cp < 0x80 ? LATIN_EXT_A[cp] : 0;
+            } else if (ch >= 'a' && ch <= 'z') {
+                letter = static_cast<char>(ch);
+            }
+            if (letter < 'a' || letter > 'z')
+                continue;
+            char code = CODES[letter - 'a'];
+            if (len == 0) {
+                res = static_cast<unsigned char>(letter - 'a' + 'A');
+                len = 1;
+            } else if (code != '0' && code != last) {
+                res |= static_cast<uint32_t>(code) << (8 * len++);
+            }
+            // h and w do not separate equal codes, vowels do
+            if (letter != 'h' && letter != 'w')
+                last = code;
+        }
+        for (; len > 0 && len < 4; ++len)
+            res |= uint32_t('0') << (8 * len);
+        return res;
+    }
+
+    // distinct Soundex codes of the tokens of a folded key
+    static std::vector<uint32_t> phoneticKeys(std::string_view folded) {
+        std::vector<uint32_t> res;
+        forEachToken(folded, [&res](std::string_view token) {
+            if (uint32_t code = soundex(token))
+                res.push_back(code);
+        });
+        std::sort(res.begin(), res.end());
+        res.erase(std::unique(res.begin(), res.end()), res.end());
+        return res;
+    }
+
+    // posting lists of the distinct query keys, rarest first so the intersection is driven by the shortest
+    // answer; empty if some key has no live student
+    template <typename M_, typename K_>
+    std::vector<const CPostingList *> postingsFor(const M_ &index, const std::vector<K_> &query) const {
+        std::vector<const STokenPostings *> entries;
+        for (const auto &key : query) {
+            auto it = index.find(key);
+            if (it == index.end() || it->second.m_Students == 0)
+                return {};
+            entries.push_back(&it->second);
+        }
+        std::sort(entries.begin(), entries.end(), [](const STokenPostings *a, const STokenPostings *b) {
+            return a->m_Students < b->m_Students;
+        });
+        std::vector<const CPostingList *> res;
+        for (const auto *entry : entries)
+            res.push_back(&entry->m_Slots);
+        return res;
+    }
 
+    std::vector<const CPostingList *> postingsFor(const std::vector<std::string> &query) const {
+        std::vector<std::pmr::string> keys;
+        for (const auto &token : query)
+            keys.emplace_back(token, m_Resource);
+        return postingsFor(m_Store->m_Postings, keys);
+    }
 
+    CStudent materialize(const SRecord &rec) const {
+        CStudent student(std::string(name(rec)), rec.m_Born, rec.m_Enrolled);
+        student.m_id = rec.m_Id;
+        return student;
+    }
 
-    static bool nameMatches(const std::string& studentName, const std::string& filterName) {
-        auto normStudentName = splitToLower(studentName);
-        auto normFilterName = splitToLower(filterName);
-        std::sort(normStudentName.begin(), normStudentName.end());
-        std::sort(normFilterName.begin(), normFilterName.end());
-        return normStudentName == normFilterName;
+    bool dead(size_t slot) const {
+        return m_Store->dead(slot);
     }
 
-    static std::vector<std::string> splitToLower(const std::string& str) {
-        std::vector<std::string> words;
-        std::string currentWord;
+    // visits live records in insertion order, a whole word of tombstone bits is skipped at once
+    template <typename F_>
+    void forEachLive(F_ fn) const {
+        const SStore &store = *m_Store;
+        for (size_t word = 0; word < store.m_Dead.size(); ++word) {
+            uint64_t live = ~store.m_Dead[word];
+            if (size_t tail = store.m_Records.size() - word * 64; tail < 64)
+                live &= (uint64_t(1) << tail) - 1;
+            while (live) {
+                fn(store.m_Records[word * 64 + std::countr_zero(live)]);
+                live &= live - 1;
+            }
+        }
+    }
 
-        for (char ch : str) {
-            if (std::isspace(static_cast<unsigned char>(ch))) {
-                if (!currentWord.empty()) {
-                    words.push_back(currentWord);
-                    currentWord.clear();
+    // Slots keep insertion order and the index orders do not depend on slots, so every index is rebuilt by
+    // walking its old order and appending the renumbered slots. Three steps:
+    //  - under the shared lock: copy the live records and the index orders into a new store (linear, no
+    //    hashing nor tree inserts), writers wait but queries do not
+    //  - with no lock: fill the identity index, the name tree, the postings and the composite indexes
+    //  - under the exclusive lock: replay what changed since the copy and swap the store pointer; that is
+    //    the only part writers and queries wait for, its cost follows the changes, not the department size
+    void compactStore() {
+        struct SRebuild {
+            std::shared_ptr<SComposite> m_Index;
+            std::vector<std::pair<ESortKey, bool>> m_Keys;
+            std::vector<size_t> m_Order;
+            std::pmr::set<size_t, CRecordOrder> m_Rows;
+        };
+        std::lock_guard compactLock(m_CompactLock);
+        auto next = std::make_unique<SStore>(m_Resource);
+        std::vector<size_t> remap, byName;
+        std::vector<uint64_t> dead;
+        std::vector<SRebuild> rebuilt;
+        size_t epoch = 0, snapshot = 0;
+        {
+            std::shared_lock lock(m_Lock);
+            const SStore &store = *m_Store;
+            epoch = m_StoreEpoch;
+            if (store.m_DeadCount > 0) {
+                snapshot = store.m_Records.size();
+                dead.assign(store.m_Dead.begin(), store.m_Dead.end());
+                remap.assign(snapshot, SIZE_MAX);
+                next->m_Records.reserve(snapshot - store.m_DeadCount);
+                forEachLive([&](const SRecord &rec) { remap[&rec - store.m_Records.data()] = next->append(store, rec); });
+                for (size_t slot : store.m_ByName)
+                    if (remap[slot] != SIZE_MAX)
+                        byName.push_back(remap[slot]);
+                std::lock_guard cacheLock(m_CacheLock);
+                for (const auto &[order, index] : m_Composite) {
+                    auto keys = index->m_Rows.key_comp().m_Keys;
+                    rebuilt.push_back(SRebuild{index, keys, {}, std::pmr::set<size_t, CRecordOrder>(
+                            CRecordOrder{next.get(), keys}, m_Resource)});
+                    for (size_t slot : index->m_Rows)
+                        if (remap[slot] != SIZE_MAX)
+                            rebuilt.back().m_Order.push_back(remap[slot]);
                 }
-            } else {
-                currentWord += std::tolower(static_cast<unsigned char>(ch));
             }
         }
 
-        if (!currentWord.empty()) {
-            words.push_back(currentWord);
+        next->m_Index.reserve(next->m_Records.size());
+        for (size_t slot = 0; slot < next->m_Records.size(); ++slot) {
+            next->m_Index.insert(slot);
+            next->addPostings(slot);
         }
+        for (size_t slot : byName)
+            next->m_ByName.insert(next->m_ByName.end(), slot);
+        for (auto &index : rebuilt)
+            for (size_t slot : index.m_Order)
+                index.m_Rows.insert(index.m_Rows.end(), slot);
 
-        return words;
+        // the old store is freed after the lock is released
+        std::unique_ptr<SStore> old;
+        std::unique_lock lock(m_Lock);
+        m_CompactPending = false;
+        if (snapshot == 0 || epoch != m_StoreEpoch)
+            return;
+        SStore &store = *m_Store;
+        // deleted since the copy
+        for (size_t word = 0; word < dead.size(); ++word) {
+            uint64_t buried = store.m_Dead[word] & ~dead[word];
+            if (size_t tail = snapshot - word * 64; tail < 64)
+                buried &= (uint64_t(1) << tail) - 1;
+            for (; buried; buried &= buried - 1)
+                next->bury(remap[word * 64 + std::countr_zero(buried)]);
+        }
+        // added since the copy, in slot order so the posting lists stay sorted
+        for (size_t slot = snapshot; slot < store.m_Records.size(); ++slot) {
+            if (store.dead(slot))
+                continue;
+            size_t moved = next->append(store, store.m_Records[slot]);
+            next->m_Index.insert(moved);
+            next->m_ByName.insert(moved);
+            next->addPostings(moved);
+            for (auto &index : rebuilt)
+                index.m_Rows.insert(moved);
+        }
+        {
+            // composite indexes made after the copy number the old slots, they are dropped and rebuilt on demand
+            std::lock_guard cacheLock(m_CacheLock);
+            for (auto it = m_Composite.begin(); it != m_Composite.end();) {
+                auto match = std::find_if(rebuilt.begin(), rebuilt.end(), [&it](const SRebuild &index) {
+                    return index.m_Index == it->second;
+                });
+                if (match == rebuilt.end()) {
+                    it = m_Composite.erase(it);
+                } else {
+                    it->second->m_Rows.swap(match->m_Rows);
+                    ++it;
+                }
+            }
+        }
+        m_Frozen.reset();
+        old = std::exchange(m_Store, std::move(next));
     }
 
+    // largest int for which `fits` holds, `fits` must hold for every smaller one too
+    template <typename F_>
+    static int bisect(F_ fits) {
+        long long lo = INT_MIN, hi = INT_MAX;
+        while (lo < hi) {
+            long long mid = lo + (hi - lo + 1) / 2;
+            if (fits(static_cast<int>(mid)))
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        return static_cast<int>(lo);
+    }
 
-};
-
-class CSort
-{
-public:
-    CSort(){}
-    CSort   & addKey( ESortKey  key ,bool ascending ){
-        m_SortKeys.emplace_back(key,ascending);
-        return *this;
+    // CDate only compares, the year is found by bisection over the smallest date of each year
+    static int yearOf(const CDate &date) {
+        return bisect([&date](int y) { return CDate(y, INT_MIN, INT_MIN) <= date; });
     }
 
-    bool isEmpty() const {
-        return m_SortKeys.empty();
+    // year, month and day, each found by bisection inside the previous one
+    static std::array<int, 3> partsOf(const CDate &date) {
+        int y = yearOf(date);
+        int m = bisect([&](int mid) { return CDate(y, mid, INT_MIN) <= date; });
+        int d = bisect([&](int mid) { return CDate(y, m, mid) <= date; });
+        return {y, m, d};
     }
 
+    template <typename M_, typename K_, typename F_>
+    static void forRange(const M_ &counts, const std::optional<K_> &after, const std::optional<K_> &before, F_ fn) {
+        for (auto it = after ? counts.upper_bound(*after) : counts.begin();
+             it != counts.end() && (!before || it->first < *before); ++it)
+            fn(it->first, it->second);
+    }
 
-    bool operator()(const CStudent& lhs, const CStudent& rhs) const {
-        for (const auto& [key, asc] : m_SortKeys) {
-            std::strong_ordering comparison = std::strong_ordering::equal;
-            switch (key) {
-                case ESortKey::NAME:
-                    if (auto cmp = lhs.getName().compare(rhs.getName()); cmp != 0)
-                        return asc ? cmp < 0 : cmp > 0;
-                    break;
-                case ESortKey::BIRTH_DATE:
-                    comparison = lhs.getDateOfBirth() <=> rhs.getDateOfBirth();
-                    if (comparison != std::strong_ordering::equal)
-                        return asc ? (comparison < 0) : (comparison > 0);
-                    break;
-                case ESortKey::ENROLL_YEAR:
-                    if (int cmp = lhs.getEnrolledYear() - rhs.getEnrolledYear(); cmp != 0)
-                        return asc ? cmp < 0 : cmp > 0;
-                    break;
-            }
+    template <typename F_>
+    void forEachEnrollBucket(const CFilter &flt, F_ fn) const {
+        if (flt.m_Names.empty()) {
+            forRange(m_EnrollCount, flt.m_EnrolledAfter, flt.m_EnrolledBefore, fn);
+            return;
         }
-        return false;
+        std::set<std::string> keys(flt.m_NameKeys.begin(), flt.m_NameKeys.end());
+        for (const auto &key : keys)
+            if (auto it = m_NameEnrollCount.find(std::pmr::string(key, m_Resource)); it != m_NameEnrollCount.end())
+                forRange(it->second, flt.m_EnrolledAfter, flt.m_EnrolledBefore, fn);
     }
 
+    template <typename M_, typename K_>
+    static void bump(M_ &counts, const K_ &key, bool add) {
+        if (add)
+            ++counts[key];
+        else if (auto it = counts.find(key); it != counts.end() && --it->second == 0)
+            counts.erase(it);
+    }
+
+    void updateCounts(const SRecord &rec, bool add) {
+        bump(m_EnrollCount, rec.m_Enrolled, add);
+        bump(m_BirthCount, rec.m_Born, add);
+        std::pmr::string key(foldedName(rec), m_Resource);
+        auto &byYear = m_NameEnrollCount.try_emplace(key).first->second;
+        bump(byYear, rec.m_Enrolled, add);
+        if (byYear.empty())
+            m_NameEnrollCount.erase(key);
+    }
+
+    std::pmr::memory_resource *m_Resource;
+    std::unique_ptr<SStore> m_Store;
+    double m_CompactRatio = 0.25;
+    bool m_CompactPending = false;
+    // bumped by clear(), a compaction built from an older store is thrown away
+    size_t m_StoreEpoch = 0;
+    // one compaction at a time; taken before m_Lock
+    std::mutex m_CompactLock;
+    // the map, the usage counts and the row counts are guarded by m_CacheLock, the rows themselves are read
+    // under m_Lock and only change under both locks
+    mutable std::map<std::string, std::shared_ptr<SComposite>> m_Composite;
+    mutable std::unordered_map<std::string, SSortUsage> m_SortUsage;
+    mutable size_t m_UseClock = 0;
+    size_t m_IndexBudget = 64 << 20;
+    int m_NextId = 0;
+    // set when this is a shard, ids then come from the sharded department and order across its shards
+    std::atomic<int> *m_SharedIds = nullptr;
+    // bumped by every mutation, cached results from older generations are never returned
+    size_t m_Generation = 0;
+    mutable CLruCache<std::list<CStudent>> m_SearchCache;
+    mutable CLruCache<std::set<std::string>> m_SuggestCache;
+    std::map<size_t, CStudyView> m_Views;
+    size_t m_NextViewId = 0;
+    std::shared_ptr<CChangeFeed> m_Feed;
+    // set by freeze(), dropped by the next mutation
+    std::unique_ptr<SFrozen> m_Frozen;
+    std::pmr::map<int, size_t> m_EnrollCount;
+    std::pmr::map<CDate, size_t> m_BirthCount;
+    std::pmr::unordered_map<std::pmr::string, std::pmr::map<int, size_t>> m_NameEnrollCount;
+    // writers take it exclusively, queries shared; the caches and composite indexes have their own lock
+    mutable std::shared_mutex m_Lock;
+    mutable std::mutex m_CacheLock;
+    const uint64_t m_Serial = nextSerial();
+    mutable std::mutex m_StatsLock;
+    mutable std::map<std::thread::id, std::unique_ptr<SThreadStats>> m_ThreadStats;
+    mutable std::once_flag m_ExecutorOnce;
+    // last member, so the workers are joined before anything they may still read is destroyed
+    mutable std::unique_ptr<CExecutor> m_Executor;
 
-private:
-    std::vector<std::pair<ESortKey, bool>> m_SortKeys;
 };
 
 
 
-class CStudyDept {
-public:
-    CStudyDept(){}
 
-    bool addStudent(const CStudent &x){
+// students spread over independent departments by identity hash; queries run on every shard at once
+// and their answers are merged, ids come from one counter so ties keep the global insertion order
+class CShardedStudyDept {
+public:
+    explicit CShardedStudyDept(size_t shards = std::thread::hardware_concurrency(), size_t cacheSize = 64) {
+        for (size_t i = 0; i < std::max<size_t>(shards, 1); ++i) {
+            m_Shards.push_back(std::make_unique<CStudyDept>(cacheSize));
+            m_Shards.back()->m_SharedIds = &m_NextId;
+        }
+        if (m_Shards.size() > 1)
+            m_Executor = std::make_unique<CExecutor>(m_Shards.size() - 1);
+    }
 
+    bool addStudent(const CStudent &x) {
+        return emplaceStudent(x.getName(), x.getDateOfBirth(), x.getEnrolledYear());
+    }
 
+    bool emplaceStudent(std::string_view name, const CDate &born, int enrolled) {
+        return shardOf(name, born, enrolled).emplaceStudent(name, born, enrolled);
     }
 
     bool delStudent(const CStudent &x) {
+        return shardOf(x.getName(), x.getDateOfBirth(), x.getEnrolledYear()).delStudent(x);
+    }
 
+    bool contains(const CStudent &x) const {
+        return shardOf(x.getName(), x.getDateOfBirth(), x.getEnrolledYear()).contains(x);
     }
 
+    void clear() {
+        for (auto &shard : m_Shards)
+            shard->clear();
+    }
+
+    size_t shards() const {
+        return m_Shards.size();
+    }
+
+    // students held by each shard, to watch the balance
+    std::vector<size_t> shardSizes() const {
+        std::vector<size_t> res;
+        for (const auto &shard : m_Shards)
+            res.push_back(shard->count(CFilter()));
+        return res;
+    }
 
     std::list<CStudent> search(const CFilter &flt, const CSort &sortOpt) const {
+        return searchWith(flt, sortOpt, sortOpt);
+    }
 
+    template <typename ... Keys_>
+    std::list<CStudent> search(const CFilter &flt, const CStaticSort<Keys_...> &sortOpt) const {
+        return searchWith(flt, sortOpt, sortOpt);
     }
 
     std::set<std::string> suggest(const std::string &name) const {
+        auto parts = scatter<std::set<std::string>>([&name](const CStudyDept &shard) { return shard.suggest(name); });
+        std::set<std::string> res = std::move(parts.front());
+        for (size_t i = 1; i < parts.size(); ++i)
+            res.merge(parts[i]);
+        return res;
+    }
+
+    size_t count(const CFilter &flt) const {
+        size_t res = 0;
+        for (size_t part : scatter<size_t>([&flt](const CStudyDept &shard) { return shard.count(flt); }))
+            res += part;
+        return res;
+    }
 
+    std::map<int, size_t> histogram(const CFilter &flt, ESortKey key) const {
+        auto parts = scatter<std::map<int, size_t>>([&](const CStudyDept &shard) { return shard.histogram(flt, key); });
+        std::map<int, size_t> res;
+        for (const auto &part : parts)
+            for (const auto &[bucket, cnt] : part)
+                res[bucket] += cnt;
+        return res;
     }
 
+    SStudyStats stats() const {
+        SStudyStats res;
+        for (const auto &shard : m_Shards)
+            res.merge(shard->stats());
+        return res;
+    }
 
 private:
+    // the full identity hash, the one the shards use themselves: students sharing a name and an intake year
+    // still spread by birth date. The high bits pick the shard so each shard's own buckets see well spread low bits
+    const CStudyDept &shardOf(std::string_view name, const CDate &born, int enrolled) const {
+        uint64_t h = CStudyDept::identityHash(name, born, enrolled) * 0xff51afd7ed558ccdULL;
+        return *m_Shards[(h >> 32) % m_Shards.size()];
+    }
 
-// map <Cstudent , and a list iterator > and list of student<Cstudent>
+    CStudyDept &shardOf(std::string_view name, const CDate &born, int enrolled) {
+        return const_cast<CStudyDept &>(std::as_const(*this).shardOf(name, born, enrolled));
+    }
 
-};
+    // the calling thread takes the first shard, the pool the rest
+    template <typename T_, typename F_>
+    std::vector<T_> scatter(F_ query) const {
+        // the workers reference `query` and whatever it captured, so nothing unwinds past here before they are done
+        struct SJoin {
+            std::vector<std::future<T_>> &m_Pending;
+            ~SJoin() {
+                for (auto &part : m_Pending)
+                    if (part.valid())
+                        part.wait();
+            }
+        };
+        std::vector<std::future<T_>> pending;
+        SJoin join{pending};
+        pending.reserve(m_Shards.size());
+        for (size_t i = 1; i < m_Shards.size(); ++i) {
+            auto promise = std::make_shared<std::promise<T_>>();
+            pending.push_back(promise->get_future());
+            m_Executor->post([promise, &query, &shard = *m_Shards[i]] {
+                try {
+                    promise->set_value(query(shard));
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+        }
+        std::vector<T_> res;
+        res.push_back(query(*m_Shards.front()));
+        for (auto &part : pending)
+            res.push_back(part.get());
+        return res;
+    }
+
+    // every shard answer is already in (sort, id) order, a heap over their fronts splices the nodes out
+    template <typename S_, typename C_>
+    std::list<CStudent> searchWith(const CFilter &flt, const S_ &sortOpt, const C_ &cmp) const {
+        auto parts = scatter<std::list<CStudent>>([&](const CStudyDept &shard) { return shard.search(flt, sortOpt); });
+        auto later = [&cmp](const std::list<CStudent> *a, const std::list<CStudent> *b) {
+            const CStudent &x = a->front(), &y = b->front();
+            if (cmp(y, x)) return true;
+            if (cmp(x, y)) return false;
+            return y.getStudentId() < x.getStudentId();
+        };
+        std::vector<std::list<CStudent> *> heap;
+        for (auto &part : parts)
+            if (!part.empty())
+                heap.push_back(&part);
+        std::make_heap(heap.begin(), heap.end(), later);
 
+        std::list<CStudent> res;
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            std::list<CStudent> *part = heap.back();
+            res.splice(res.end(), *part, part->begin());
+            if (part->empty())
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(), heap.end(), later);
+        }
+        return res;
+    }
 
+    std::atomic<int> m_NextId{0};
+    std::vector<std::unique_ptr<CStudyDept>> m_Shards;
+    // last member, so the workers are joined before the shards go away
+    std::unique_ptr<CExecutor> m_Executor;
+};
 
 
-#ifndef __PROGTEST__
+// bench.cpp includes this file with STUDYDEPT_BENCHMARK defined and brings its own main
+#if !defined(__PROGTEST__) && !defined(STUDYDEPT_BENCHMARK)
 int main ( void )
 {
     CStudyDept x0;
@@ -307,67 +3583,67 @@ int main ( void )
 //                  << " Date of Birth: " << student.getDateOfBirth()
 //                  << " Enrolled Year: " << student.getEnrolledYear() << std::endl;
 //    }
-//    assert ( x0 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
-//            {
-//                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
-//                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
-//                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
-//                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
-//                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
-//            }) );
-
-
-
-//    assert ( x0 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, false ) ) == (std::list<CStudent>
-//            {
-//                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 ),
-//                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
-//                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
-//                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
-//                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 )
-//            }) );
-//    assert ( x0 . search ( CFilter (), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
-//            {
-//                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
-//                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
-//                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
-//                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
-//                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
-//                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
-//            }) );
-//    assert ( x0 . search ( CFilter () . name ( "james bond" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
-//            {
-//                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
-//                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 )
-//            }) );
-//    assert ( x0 . search ( CFilter () . bornAfter ( CDate ( 1980, 4, 11) ) . bornBefore ( CDate ( 1983, 7, 13) ) . name ( "John Taylor" ) . name ( "james BOND" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
-//            {
-//                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
-//                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
-//                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 )
-//            }) );
+    assert ( x0 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
+                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
+                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
+            }) );
+
+
+
+    assert ( x0 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, false ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 ),
+                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
+                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 )
+            }) );
+    assert ( x0 . search ( CFilter (), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
+                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
+                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
+            }) );
+    assert ( x0 . search ( CFilter () . name ( "james bond" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 )
+            }) );
+    assert ( x0 . search ( CFilter () . bornAfter ( CDate ( 1980, 4, 11) ) . bornBefore ( CDate ( 1983, 7, 13) ) . name ( "John Taylor" ) . name ( "james BOND" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 )
+            }) );
     assert ( x0 . search ( CFilter () . name ( "james" ), CSort () . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
             {
             }) );
@@ -398,18 +3674,747 @@ int main ( void )
                     "John Peter Taylor",
                     "Peter John Taylor"
             }) );
-//    assert ( ! x0 . addStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
+    assert ( ! x0 . addStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
     assert ( x0 . delStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
-//    assert ( x0 . search ( CFilter () . bornAfter ( CDate ( 1980, 4, 11) ) . bornBefore ( CDate ( 1983, 7, 13) ) . name ( "John Taylor" ) . name ( "james BOND" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
-//            {
-//                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
-//                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
-//                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
-//                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 )
-//            }) );
+    assert ( x0 . search ( CFilter () . bornAfter ( CDate ( 1980, 4, 11) ) . bornBefore ( CDate ( 1983, 7, 13) ) . name ( "John Taylor" ) . name ( "james BOND" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 )
+            }) );
     assert ( ! x0 . delStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
+    assert ( x0 . count ( CFilter () ) == 9 );
+    assert ( x0 . count ( CFilter () . enrolledAfter ( 2012 ) . name ( "james bond" ) ) == 4 );
+    assert ( x0 . count ( CFilter () . bornAfter ( CDate ( 1983, 1, 1) ) ) == 2 );
+    assert ( x0 . count ( CFilter () . bornBefore ( CDate ( 1982, 1, 1) ) . enrolledAfter ( 2011 ) ) == 5 );
+    assert ( x0 . histogram ( CFilter (), ESortKey::ENROLL_YEAR ) == (std::map<int, size_t>
+            {
+                    { 2011, 1 }, { 2012, 2 }, { 2013, 4 }, { 2014, 1 }, { 2017, 1 }
+            }) );
+    assert ( x0 . histogram ( CFilter () . bornAfter ( CDate ( 1981, 12, 31) ), ESortKey::BIRTH_DATE ) == (std::map<int, size_t>
+            {
+                    { 1982, 2 }, { 1983, 1 }, { 1984, 1 }
+            }) );
+    assert ( x0 . histogram ( CFilter () . name ( "john taylor" ) . enrolledBefore ( 2015 ), ESortKey::BIRTH_DATE ) == (std::map<int, size_t>
+            {
+                    { 1981, 1 }
+            }) );
+
+    assert ( x0 . search ( CFilter () . bornBefore ( CDate ( 1982, 1, 1) ), CSort () . addKey ( ESortKey::NAME, false ) . addKey ( ESortKey::ENROLL_YEAR, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 )
+            }) );
+
+    CSort byYear = CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) . addKey ( ESortKey::BIRTH_DATE, false ) . addKey ( ESortKey::NAME, true );
+    std::list<CStudent> byYearRes = x0 . search ( CFilter () . enrolledBefore ( 2013 ), byYear );
+    for ( int i = 0; i < 3; i ++ )
+    {
+      std::list<CStudent> res = x0 . search ( CFilter () . enrolledBefore ( 2013 ) . bornAfter ( CDate ( 1900 + i, 1, 1) ), byYear );
+      assert ( res == byYearRes );
+    }
+    // the third use posts the build to the executor
+    for ( auto deadline = std::chrono::steady_clock::now () + std::chrono::seconds ( 5 );
+          x0 . compositeIndexes () == 0 && std::chrono::steady_clock::now () < deadline; )
+      std::this_thread::yield ();
+    assert ( x0 . compositeIndexes () == 1 );
+    assert ( x0 . search ( CFilter () . enrolledBefore ( 2013 ), byYear ) == byYearRes );
+    assert ( x0 . addStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
+    assert ( x0 . search ( CFilter () . name ( "john taylor" ) . name ( "james BOND" ) . bornAfter ( CDate ( 1980, 4, 11) ) . bornBefore ( CDate ( 1983, 7, 13) ), byYear ) == (std::list<CStudent>
+            {
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 )
+            }) );
+    assert ( x0 . delStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
+    x0 . setIndexBudget ( 0 );
+    assert ( x0 . compositeIndexes () == 0 );
+    assert ( x0 . search ( CFilter () . enrolledBefore ( 2013 ), byYear ) == byYearRes );
+
+    CStaticSort<CSortKey<ESortKey::ENROLL_YEAR, false>, CSortKey<ESortKey::BIRTH_DATE, false>, CSortKey<ESortKey::NAME, true>> byYearStatic;
+    assert ( byYearStatic . dynamic () . key () == byYear . key () );
+    assert ( x0 . search ( CFilter () . enrolledBefore ( 2013 ), byYearStatic ) == byYearRes );
+    assert ( x0 . search ( CFilter () . name ( "James Bond" ), CStaticSort<CSortKey<ESortKey::NAME, true>, CSortKey<ESortKey::ENROLL_YEAR, true>> () ) == (std::list<CStudent>
+            {
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 16), 2012 ),
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 )
+            }) );
+    assert ( x0 . search ( CFilter () . enrolledAfter ( 2013 ), CStaticSort<CSortKey<ESortKey::BIRTH_DATE, true>> () ) == (std::list<CStudent>
+            {
+                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
+                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 )
+            }) );
+
+    CFilter exprFilter = CFilter () . where ( ( CFilterExpr::bornBefore ( CDate ( 1982, 1, 1) ) || CFilterExpr::enrolledAfter ( 2013 ) ) && ! CFilterExpr::name ( "james BOND" ) );
+    assert ( x0 . search ( exprFilter, CSort () ) == (std::list<CStudent>
+            {
+                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
+                    CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ),
+                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 )
+            }) );
+    assert ( x0 . count ( exprFilter ) == 3 );
+    assert ( x0 . count ( CFilter () . where ( ! ( ! CFilterExpr::enrolledBefore ( 2013 ) ) ) ) == x0 . count ( CFilter () . enrolledBefore ( 2013 ) ) );
+    CFilter mixedFilter = CFilter () . enrolledAfter ( 2012 ) . where ( CFilterExpr::name ( "bond james" ) || CFilterExpr::name ( "peter john taylor" ) );
+    assert ( x0 . search ( mixedFilter, CSort () ) == (std::list<CStudent>
+            {
+                    CStudent ( "John Peter Taylor", CDate ( 1983, 7, 13), 2014 ),
+                    CStudent ( "Peter John Taylor", CDate ( 1984, 1, 17), 2017 ),
+                    CStudent ( "James Bond", CDate ( 1982, 7, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 8, 16), 2013 ),
+                    CStudent ( "James Bond", CDate ( 1981, 7, 17), 2013 ),
+                    CStudent ( "Bond James", CDate ( 1981, 7, 16), 2013 )
+            }) );
+    assert ( x0 . histogram ( mixedFilter, ESortKey::ENROLL_YEAR ) == (std::map<int, size_t>
+            {
+                    { 2013, 4 }, { 2014, 1 }, { 2017, 1 }
+            }) );
+
+    auto byYearAsync = x0 . searchAsync ( CFilter () . enrolledBefore ( 2013 ), byYear );
+    auto suggestFuture = x0 . suggestAsync ( "bond" );
+    assert ( byYearAsync . get () == byYearRes );
+    assert ( suggestFuture . get () == x0 . suggest ( "bond" ) );
+    std::stop_source stopSearch;
+    stopSearch . request_stop ();
+    auto stopped = x0 . searchAsync ( CFilter () . name ( "nobody" ), CSort (), stopSearch . get_token () );
+    try
+    {
+      stopped . get ();
+      assert ( "missing exception" == nullptr );
+    }
+    catch ( const CQueryCancelled & e )
+    {
+    }
+    auto late = x0 . suggestAsync ( "nobody", {}, std::chrono::steady_clock::now () - std::chrono::seconds ( 1 ) );
+    try
+    {
+      late . get ();
+      assert ( "missing exception" == nullptr );
+    }
+    catch ( const CQueryCancelled & e )
+    {
+    }
+
+    {
+      // synchronous reads next to a writer, each of them holds the shared lock
+      CStudyDept x13;
+      for ( int i = 0; i < 300; ++i )
+        assert ( x13 . addStudent ( CStudent ( "Reader " + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 5 ) ) );
+      std::thread writer ( [&x13] {
+        for ( int i = 0; i < 300; ++i )
+          assert ( x13 . delStudent ( CStudent ( "Reader " + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 5 ) ) );
+      } );
+      for ( int i = 0; i < 50; ++i )
+      {
+        assert ( x13 . search ( CFilter (), CSort () ) . size () <= 300 );
+        assert ( x13 . search ( CFilter () . enrolledAfter ( 2011 ), CStaticSort<CSortKey<ESortKey::NAME, true>> () ) . size () <= 180 );
+        assert ( x13 . count ( CFilter () ) <= 300 && x13 . suggest ( "reader" ) . size () <= 300 );
+      }
+      writer . join ();
+      assert ( x13 . search ( CFilter (), CSort () ) . empty () && x13 . suggest ( "reader" ) . empty () );
+    }
+
+    {
+      // background compaction while another thread keeps adding, deleting and searching
+      CStudyDept x14 ( 0 );
+      auto churn = [] ( int i ) { return CStudent ( "Churn " + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 7 ); };
+      for ( int i = 0; i < 4000; ++i )
+        assert ( x14 . addStudent ( churn ( i ) ) );
+      std::thread writer ( [&x14, &churn] {
+        for ( int i = 0; i < 4000; ++i )
+        {
+          if ( i % 4 != 3 )
+            assert ( x14 . delStudent ( churn ( i ) ) );
+          if ( i % 8 == 0 )
+            assert ( x14 . addStudent ( churn ( 4000 + i ) ) );
+        }
+      } );
+      for ( int i = 0; i < 40; ++i )
+      {
+        auto rows = x14 . search ( CFilter () . enrolledAfter ( 2014 ), CSort () . addKey ( ESortKey::NAME, true ) );
+        assert ( std::is_sorted ( rows . begin (), rows . end (), [] ( const CStudent & a, const CStudent & b ) { return a . getName () < b . getName (); } ) );
+        assert ( x14 . count ( CFilter () ) >= 1000 && x14 . suggest ( "churn 3" ) . size () <= 1 );
+      }
+      writer . join ();
+      x14 . compact ();
+      assert ( x14 . tombstones () == 0 && x14 . count ( CFilter () ) == 1500 );
+      std::list<CStudent> expected;
+      for ( int i = 0; i < 4000; ++i )
+      {
+        if ( i % 4 == 3 )
+          expected . push_back ( churn ( i ) );
+        if ( i % 8 == 0 )
+          expected . push_back ( churn ( 4000 + i ) );
+      }
+      expected . sort ( [] ( const CStudent & a, const CStudent & b ) { return a . getName () < b . getName (); } );
+      assert ( x14 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, true ) ) == expected );
+      assert ( x14 . contains ( churn ( 3 ) ) && ! x14 . contains ( churn ( 2 ) ) && x14 . contains ( churn ( 7992 ) ) );
+      assert ( x14 . suggest ( "churn 3999" ) == ( std::set<std::string> { "Churn 3999" } ) && x14 . suggest ( "churn 3998" ) . empty () );
+      assert ( x14 . tokenFrequency ( "churn" ) == 1500 );
+    }
+
+    CStudyDept x3;
+    CFeedSubscriber fast = x3 . subscribe ( 8 );
+    // the ring is shared: no capacity joins it, a different one is refused, one rounding to 8 slots is fine
+    CFeedSubscriber slow = x3 . subscribe ();
+    try
+    {
+      x3 . subscribe ( 4096 );
+      assert ( "missing exception" == nullptr );
+    }
+    catch ( const std::invalid_argument & e )
+    {
+    }
+    CFeedSubscriber rounded = x3 . subscribe ( 7 );
+    std::string longName = "Anna Maria " + std::string ( 200, 'x' ) + " Taylor";
+    assert ( x3 . addStudent ( CStudent ( longName, CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x3 . addStudent ( CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ) ) );
+    std::vector<SMutation> feed;
+    assert ( fast . poll ( feed, 1 ) == 1 && feed[0] . m_Added && feed[0] . m_Student == CStudent ( longName, CDate ( 1990, 1, 1), 2015 ) );
+    assert ( fast . poll ( feed ) == 1 && feed[1] . m_Seq == 1 && feed[1] . m_Student . getStudentId () == 1 );
+    assert ( x3 . delStudent ( CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ) ) );
+    feed . clear ();
+    assert ( fast . poll ( feed ) == 1 && ! feed[0] . m_Added && feed[0] . m_Student == CStudent ( "John Taylor", CDate ( 1981, 6, 30), 2012 ) );
+    for ( int i = 0; i < 20; i ++ )
+      assert ( x3 . addStudent ( CStudent ( "Student " + std::to_string ( i ), CDate ( 1990, 1, 1), 2015 ) ) );
+    feed . clear ();
+    assert ( fast . poll ( feed ) > 0 && feed . size () < 20 && fast . lost () + feed . size () == 20 );
+    assert ( feed . back () . m_Student . getName () == "Student 19" );
+    feed . clear ();
+    assert ( slow . poll ( feed ) > 0 && slow . lost () + feed . size () == 23 && feed . back () . m_Student . getName () == "Student 19" );
+    assert ( x3 . addStudent ( CStudent ( "Late Comer", CDate ( 1990, 1, 1), 2015 ) ) );
+    feed . clear ();
+    assert ( fast . poll ( feed ) == 1 && slow . poll ( feed ) == 1 && feed[0] . m_Seq == 23 && feed[1] . m_Seq == 23 );
+
+    CShardedStudyDept x4 ( 4 );
+    CStudyDept x5;
+    for ( int i = 0; i < 60; i ++ )
+    {
+      CStudent st ( ( i % 3 ? "John " : "Peter " ) + std::string ( i % 2 ? "Taylor" : "Bond" ), CDate ( 1980 + i % 7, 1 + i % 12, 1 + i % 28 ), 2010 + i % 5 );
+      assert ( x4 . addStudent ( st ) == x5 . addStudent ( st ) );
+    }
+    assert ( x4 . shards () == 4 && ! x4 . addStudent ( CStudent ( "Peter Bond", CDate ( 1980, 1, 1), 2010 ) ) );
+    assert ( x4 . search ( CFilter (), CSort () ) == x5 . search ( CFilter (), CSort () ) );
+    assert ( x4 . search ( CFilter () . name ( "john taylor" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) ) == x5 . search ( CFilter () . name ( "john taylor" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) ) );
+    assert ( x4 . search ( CFilter () . bornAfter ( CDate ( 1982, 1, 1) ), CStaticSort<CSortKey<ESortKey::NAME, true>> () ) == x5 . search ( CFilter () . bornAfter ( CDate ( 1982, 1, 1) ), CStaticSort<CSortKey<ESortKey::NAME, true>> () ) );
+    assert ( x4 . suggest ( "bond" ) == (std::set<std::string> { "John Bond", "Peter Bond" }) );
+    assert ( x4 . count ( CFilter () . name ( "bond peter" ) ) == 10 && x4 . histogram ( CFilter (), ESortKey::ENROLL_YEAR ) == x5 . histogram ( CFilter (), ESortKey::ENROLL_YEAR ) );
+    assert ( x4 . delStudent ( CStudent ( "Peter Bond", CDate ( 1980, 1, 1), 2010 ) ) && ! x4 . contains ( CStudent ( "Peter Bond", CDate ( 1980, 1, 1), 2010 ) ) );
+    assert ( x4 . count ( CFilter () ) == 59 );
+    {
+      // one name and one intake year still fill every shard evenly
+      CShardedStudyDept skewed ( 4 );
+      for ( int i = 0; i < 4000; i ++ )
+        assert ( skewed . addStudent ( CStudent ( "Jan Novak", CDate ( 1980 + i / 336, 1 + i / 28 % 12, 1 + i % 28 ), 2020 ) ) );
+      std::vector<size_t> sizes = skewed . shardSizes ();
+      size_t total = 0;
+      for ( size_t size : sizes )
+      {
+        assert ( size > 800 && size < 1200 );
+        total += size;
+      }
+      assert ( sizes . size () == 4 && total == 4000 );
+      assert ( skewed . contains ( CStudent ( "Jan Novak", CDate ( 1980, 1, 1 ), 2020 ) ) );
+      assert ( skewed . delStudent ( CStudent ( "Jan Novak", CDate ( 1980, 1, 1 ), 2020 ) ) && skewed . count ( CFilter () ) == 3999 );
+    }
+    // every shard throws, the first on the calling thread; the others finish before the query captures unwind
+    for ( int i = 0; i < 20; i ++ )
+      try
+      {
+        x4 . histogram ( CFilter () . name ( "john bond" ), ESortKey::NAME );
+        assert ( "missing exception" == nullptr );
+      }
+      catch ( const std::invalid_argument & e )
+      {
+      }
+    assert ( x4 . count ( CFilter () . name ( "john bond" ) ) == 20 );
+    std::vector<CFilter> ranges
+    {
+            CFilter () . bornAfter ( CDate ( 1982, 1, 1) ) . bornBefore ( CDate ( 1985, 6, 1) ),
+            CFilter () . enrolledAfter ( 2011 ),
+            CFilter () . enrolledBefore ( 2013 ) . bornAfter ( CDate ( 1983, 5, 5) ) . name ( "john taylor" ),
+            CFilter () . bornAfter ( CDate ( 1990, 1, 1) ),
+            CFilter () . bornBefore ( CDate ( 1980, 1, 1) ),
+            CFilter () . enrolledAfter ( 2013 ) . enrolledBefore ( 2012 )
+    };
+    std::vector<CSort> orders { CSort (), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) };
+    std::vector<std::list<CStudent>> thawed;
+    std::vector<size_t> thawedCounts;
+    for ( const auto & flt : ranges )
+    {
+      thawedCounts . push_back ( x5 . count ( flt ) );
+      for ( const auto & order : orders )
+        thawed . push_back ( x5 . search ( flt, order ) );
+    }
+    CStudyDept x8;
+    for ( const auto & st : x5 . search ( CFilter (), CSort () ) )
+      assert ( x8 . addStudent ( st ) );
+    x5 . freeze ();
+    x8 . freeze ();
+    assert ( x5 . frozen () && x8 . frozen () );
+    for ( size_t i = 0; i < ranges . size (); i ++ )
+    {
+      assert ( x5 . count ( ranges[i] ) == thawedCounts[i] );
+      for ( size_t j = 0; j < orders . size (); j ++ )
+        assert ( x8 . search ( ranges[i], orders[j] ) == thawed[i * orders . size () + j] );
+    }
+    assert ( thawedCounts[0] > 0 && thawedCounts[3] == 0 && thawedCounts[5] == 0 );
+    assert ( ! x5 . addStudent ( CStudent ( "Peter Bond", CDate ( 1980, 1, 1), 2010 ) ) && x5 . frozen () );
+    assert ( x5 . addStudent ( CStudent ( "Peter Bond", CDate ( 1984, 1, 1), 2012 ) ) && ! x5 . frozen () );
+    assert ( x5 . count ( ranges[0] ) == thawedCounts[0] + 1 );
+
+    assert ( CFilter::fingerprint ( "Bond James" ) == CFilter::fingerprint ( "  james\tBOND " ) );
+    assert ( CFilter::fingerprint ( "James Bond" ) == CFilter::fingerprint ( std::vector<std::string> { "bond", "james" } ) );
+    assert ( CFilter::fingerprint ( "James Bond" ) != CFilter::fingerprint ( "James Bond Bond" ) );
+    assert ( CFilter::fingerprint ( "James Bond" ) != CFilter::fingerprint ( "James Bonds" ) );
+
+    assert ( CFilter::splitToLower ( "  Anna-Maria\tVAN der   Berg\nO'NEILL \xC3\x89mile  ABCDEFGHIJKLMNOPQRSTUVWXYZ " ) == (std::vector<std::string>
+            {
+                    "anna-maria", "van", "der", "berg", "o'neill", "\xC3\xA9mile", "abcdefghijklmnopqrstuvwxyz"
+            }) );
+    assert ( CFilter::splitToLower ( std::string ( 40, ' ' ) ) . empty () && CFilter::splitToLower ( std::string ( 33, 'Q' ) ) == std::vector<std::string> { std::string ( 33, 'q' ) } );
+
+    assert ( CFilter::splitToLower ( "\u0160\u0164ASTN\u00DD \u03A3\u03A9\u039A\u03A1\u0386\u03A4\u0397\u03A3 \u0418\u0412\u0410\u041D STRAU\u00DF" ) == (std::vector<std::string>
+            {
+                    "\u0161\u0165astn\u00FD", "\u03C3\u03C9\u03BA\u03C1\u03AC\u03C4\u03B7\u03C3", "\u0438\u0432\u0430\u043D", "strauss"
+            }) );
+    assert ( CFilter::splitToLower ( "\u01CDR\u01C4 \u1E9EIN\u1EA0 \u0532 \uFF21\uFF3A \U00010400\U0001E900 \u023A" ) == (std::vector<std::string>
+            {
+                    "\u01CEr\u01C6", "ssin\u1EA1", "\u0562", "\uFF41\uFF5A", "\U00010428\U0001E922", "\u023A"
+            }) );
+    // outside the supported subset: Turkic dotted I, Greek Extended, Cherokee
+    assert ( CFilter::splitToLower ( "\u0130STANBUL \u1F08 \u13A0" ) == (std::vector<std::string> { "\u0130stanbul", "\u1F08", "\u13A0" }) );
+    CStudyDept x6;
+    assert ( x6 . addStudent ( CStudent ( "Jan \u0160\u0165astn\u00FD", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x6 . addStudent ( CStudent ( "\u03A3\u03C9\u03BA\u03C1\u03AC\u03C4\u03B7\u03C2 Strau\u00DF", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x6 . count ( CFilter () . name ( "\u0160\u0164ASTN\u00DD jan" ) ) == 1 );
+    assert ( x6 . count ( CFilter () . name ( "STRAUSS \u03C3\u03C9\u03BA\u03C1\u03AC\u03C4\u03B7\u03C3" ) ) == 1 );
+    assert ( x6 . count ( CFilter () . where ( CFilterExpr::name ( "jan \u0161\u0165astn\u00FD" ) ) ) == 1 );
+    assert ( x6 . suggest ( "\u0161\u0165astn\u00FD" ) == (std::set<std::string> { "Jan \u0160\u0165astn\u00FD" }) );
+    assert ( x6 . addStudent ( CStudent ( "Robert Smith", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x6 . addStudent ( CStudent ( "Rupert Smyth", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x6 . addStudent ( CStudent ( "Robert Ashcraft", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x6 . suggestPhonetic ( "smithe RUBERT" ) == (std::set<std::string> { "Robert Smith", "Rupert Smyth" }) );
+    assert ( x6 . suggestPhonetic ( "stastny" ) == (std::set<std::string> { "Jan \u0160\u0165astn\u00FD" }) );
+    assert ( x6 . suggestPhonetic ( "Straus" ) == (std::set<std::string> { "\u03A3\u03C9\u03BA\u03C1\u03AC\u03C4\u03B7\u03C2 Strau\u00DF" }) );
+    assert ( x6 . suggestPhonetic ( "Ashkroft" ) == (std::set<std::string> { "Robert Ashcraft" }) && x6 . suggestPhonetic ( "42" ) . empty () );
+    assert ( x6 . delStudent ( CStudent ( "Rupert Smyth", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x6 . suggestPhonetic ( "Smith" ) == (std::set<std::string> { "Robert Smith" }) );
+
+    CPostingList postings;
+    std::vector<uint32_t> slots;
+    for ( uint32_t i = 0, slot = 0; i < 1000; i ++ )
+    {
+      slot += 1 + ( i % 300 ? i % 5 : 70000 );
+      postings . append ( slot );
+      slots . push_back ( slot );
+    }
+    CPostingList::CCursor cursor ( postings );
+    for ( uint32_t slot : slots )
+    {
+      assert ( ! cursor . done () && cursor . value () == slot );
+      cursor . next ();
+    }
+    assert ( cursor . done () && postings . bytes () * 2 < slots . size () * sizeof ( uint32_t ) );
+    CPostingList::CCursor seeker ( postings );
+    for ( uint32_t target : { 5u, 300u, 70100u, 140500u, 210000u, 10000000u } )
+    {
+      seeker . seek ( target );
+      auto it = std::lower_bound ( slots . begin (), slots . end (), target );
+      assert ( it == slots . end () ? seeker . done () : seeker . value () == *it );
+    }
+    {
+      // the row budget evicts old entries and refuses a result that could never fit
+      CLruCache<std::vector<int>> lru ( 8, 10 );
+      lru . insert ( "a", 0, std::vector<int> ( 4 ) );
+      lru . insert ( "b", 0, std::vector<int> ( 4 ) );
+      assert ( lru . size () == 2 && lru . rows () == 8 );
+      assert ( lru . find ( "a", 0 ) );
+      lru . insert ( "c", 0, std::vector<int> ( 5 ) );
+      assert ( lru . size () == 2 && lru . rows () == 9 && ! lru . contains ( "b", 0 ) && lru . contains ( "a", 0 ) );
+      lru . insert ( "d", 0, std::vector<int> ( 11 ) );
+      assert ( lru . size () == 2 && ! lru . contains ( "d", 0 ) );
+      lru . insert ( "a", 0, std::vector<int> ( 11 ) );
+      assert ( lru . size () == 1 && lru . rows () == 5 && ! lru . find ( "c", 1 ) && lru . rows () == 0 );
+    }
+    CStudyDept x7;
+    for ( int i = 0; i < 600; i ++ )
+      assert ( x7 . addStudent ( CStudent ( "Jan " + std::string ( i % 2 ? "Novak " : "Svoboda " ) + std::to_string ( i % 7 ), CDate ( 1990, 1, 1), 2000 + i ) ) );
+    assert ( x7 . suggest ( "3 NOVAK jan" ) == (std::set<std::string> { "Jan Novak 3" }) );
+    assert ( x7 . suggest ( "novak" ) . size () == 7 && x7 . suggest ( "novak svoboda" ) . empty () && x7 . suggest ( "jan nobody" ) . empty () );
+    for ( int i = 0; i < 600; i += 2 )
+      assert ( x7 . delStudent ( CStudent ( "Jan Svoboda " + std::to_string ( i % 7 ), CDate ( 1990, 1, 1), 2000 + i ) ) );
+    x7 . compact ();
+    assert ( x7 . tombstones () == 0 && x7 . suggest ( "svoboda" ) . empty () && x7 . suggest ( "jan" ) . size () == 7 );
+    assert ( x7 . tokenFrequency ( "NOVAK" ) == 300 && x7 . tokenFrequency ( "svoboda" ) == 0 && x7 . tokenFrequency ( "3" ) == 43 );
+    assert ( x7 . addStudent ( CStudent ( "Novak Jan", CDate ( 1990, 1, 1), 2000 ) ) );
+    assert ( x7 . addStudent ( CStudent ( "Novak", CDate ( 1990, 1, 1), 2000 ) ) );
+    assert ( x7 . suggest ( "novak", 3 ) == (std::vector<std::string> { "Novak", "Novak Jan", "Jan Novak 0" }) );
+    assert ( x7 . suggest ( "jan 3 novak", 5 ) == (std::vector<std::string> { "Jan Novak 3" }) && x7 . suggest ( "novak", 0 ) . empty () );
+
+    CStudyDept x9;
+    assert ( x9 . addStudent ( CStudent ( "Smith, John", CDate ( 1990, 12, 31), 2015 ) ) );
+    assert ( x9 . addStudent ( CStudent ( "Anna \"Ann\" Lee", CDate ( -5, 1, 2), -2010 ) ) );
+    assert ( x9 . addStudent ( CStudent ( "Back\\slash", CDate ( 1990, 12, 31), 2016 ) ) );
+    auto exported = [&x9] ( const CFilter & flt, const CSort & order, EExportFormat format )
+    {
+      int fds[2];
+      [[maybe_unused]] int rc = pipe ( fds );
+      assert ( rc == 0 );
+      x9 . exportTo ( fds[1], flt, order, format );
+      close ( fds[1] );
+      std::string text;
+      char buf[256];
+      for ( ssize_t n; ( n = read ( fds[0], buf, sizeof ( buf ) ) ) > 0; )
+        text . append ( buf, n );
+      close ( fds[0] );
+      return text;
+    };
+    assert ( exported ( CFilter (), CSort (), EExportFormat::CSV ) == "name,born,enrolled\n"
+                                                                     "\"Smith, John\",1990-12-31,2015\n"
+                                                                     "\"Anna \"\"Ann\"\" Lee\",-5-1-2,-2010\n"
+                                                                     "Back\\slash,1990-12-31,2016\n" );
+    assert ( exported ( CFilter () . bornAfter ( CDate ( 0, 1, 1) ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ), EExportFormat::JSON )
+             == "[\n{\"name\":\"Back\\\\slash\",\"born\":\"1990-12-31\",\"enrolled\":2016},"
+                "\n{\"name\":\"Smith, John\",\"born\":\"1990-12-31\",\"enrolled\":2015}\n]\n" );
+    assert ( exported ( CFilter () . enrolledAfter ( 3000 ), CSort (), EExportFormat::JSON ) == "[]\n" );
+    {
+      // the reader stalls with the pipe full, the exporter blocks in write but holds no lock meanwhile
+      CStudyDept x17;
+      for ( int i = 0; i < 10000; i ++ )
+        assert ( x17 . addStudent ( CStudent ( "Stalled Reader " + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 10 ) ) );
+      int fds[2];
+      [[maybe_unused]] int rc = pipe ( fds );
+      assert ( rc == 0 );
+      size_t rows = 0;
+      std::thread exporter ( [&] {
+        rows = x17 . exportTo ( fds[1], CFilter (), CSort () . addKey ( ESortKey::NAME, true ) );
+        close ( fds[1] );
+      } );
+      char buf[4096];
+      ssize_t first = read ( fds[0], buf, 1 );
+      std::atomic<bool> added = false;
+      std::thread adder ( [&] {
+        bool ok = x17 . addStudent ( CStudent ( "Late Writer", CDate ( 1990, 1, 1 ), 2020 ) );
+        added = ok;
+      } );
+      for ( auto deadline = std::chrono::steady_clock::now () + std::chrono::seconds ( 5 );
+            ! added && std::chrono::steady_clock::now () < deadline; )
+        std::this_thread::sleep_for ( std::chrono::milliseconds ( 1 ) );
+      bool addedWhileStalled = added;
+      size_t lines = first == 1 && buf[0] == '\n';
+      for ( ssize_t n; ( n = read ( fds[0], buf, sizeof ( buf ) ) ) > 0; )
+        lines += std::count ( buf, buf + n, '\n' );
+      close ( fds[0] );
+      exporter . join ();
+      adder . join ();
+      assert ( addedWhileStalled && rows == 10000 && lines == 10001 && x17 . count ( CFilter () ) == 10001 );
+    }
+    {
+      int fds[2];
+      [[maybe_unused]] int rc = pipe ( fds );
+      assert ( rc == 0 );
+      CExportWriter writer ( fds[1], EExportFormat::CSV, 256 );
+      std::string expected = "name,born,enrolled\n";
+      for ( int i = 0; i < 100; i ++ )
+      {
+        std::string name = "Student " + std::string ( i % 50, 'x' ) + std::to_string ( i );
+        writer . row ( name, 2000, 1 + i % 12, 1 + i % 28, 2020 + i );
+        expected += name + ",2000-" + std::to_string ( 1 + i % 12 ) + "-" + std::to_string ( 1 + i % 28 ) + "," + std::to_string ( 2020 + i ) + "\n";
+      }
+      assert ( writer . finish () == 100 );
+      close ( fds[1] );
+      std::string text ( expected . size () + 1, '\0' );
+      size_t got = 0;
+      for ( ssize_t n; ( n = read ( fds[0], text . data () + got, text . size () - got ) ) > 0; )
+        got += n;
+      close ( fds[0] );
+      assert ( got == expected . size () && text . substr ( 0, got ) == expected );
+    }
+
+    if constexpr ( STUDYDEPT_STATS )
+    {
+      CStudyDept x10;
+      for ( int i = 0; i < 50; ++i )
+        assert ( x10 . addStudent ( CStudent ( "Stat Student" + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 5 ) ) );
+      assert ( x10 . delStudent ( CStudent ( "Stat Student0", CDate ( 1990, 1, 1 ), 2010 ) ) );
+      assert ( ! x10 . delStudent ( CStudent ( "Stat Student0", CDate ( 1990, 1, 1 ), 2010 ) ) );
+      assert ( x10 . search ( CFilter () . enrolledAfter ( 2012 ), CSort () ) . size () == 20 );
+      assert ( x10 . search ( CFilter () . enrolledAfter ( 2012 ), CSort () ) . size () == 20 );
+      assert ( x10 . suggest ( "student7" ) . size () == 1 );
+      assert ( x10 . suggest ( "student7" ) . size () == 1 );
+      std::thread ( [&x10] { x10 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, true ) ); } ) . join ();
+      SStudyStats st = x10 . stats ();
+      assert ( st . latency ( EStatOp::ADD ) . count () == 50 && st . latency ( EStatOp::DEL ) . count () == 2 );
+      assert ( st . latency ( EStatOp::SEARCH ) . count () == 3 && st . latency ( EStatOp::SUGGEST ) . count () == 2 );
+      assert ( st[EStat::SEARCH_CACHE_HIT] == 1 && st[EStat::SEARCH_CACHE_MISS] == 2 );
+      assert ( st[EStat::SUGGEST_CACHE_HIT] == 1 && st[EStat::SUGGEST_CACHE_MISS] == 1 );
+      assert ( st[EStat::NAME_INDEX] == 1 );
+      assert ( st[EStat::NAME_INDEX] + st[EStat::COMPOSITE_INDEX] + st[EStat::FROZEN_INDEX] + st[EStat::FULL_SCAN] == 2 );
+      assert ( st[EStat::ROWS_RETURNED] == 20 + 49 + 1 && st[EStat::ROWS_SCANNED] >= st[EStat::ROWS_RETURNED] );
+      const CLatencyHistogram & adds = st . latency ( EStatOp::ADD );
+      assert ( adds . percentile ( 0.5 ) <= adds . percentile ( 0.99 ) && adds . percentile ( 1 ) >= adds . mean () );
+      CLatencyHistogram hist;
+      for ( uint64_t v : { 3, 100, 1000, 1000, 1000000 } )
+        hist . add ( CLatencyHistogram::bucketOf ( v ), 1, v );
+      assert ( hist . count () == 5 && hist . percentile ( 0 ) == 3 && hist . percentile ( 0.2 ) == 3 );
+      assert ( hist . percentile ( 0.6 ) >= 1000 && hist . percentile ( 0.6 ) < 1000 + 1000 / 16 );
+      assert ( hist . percentile ( 1 ) >= 1000000 && hist . percentile ( 1 ) < 1000000 + 1000000 / 16 );
+      CShardedStudyDept x11 ( 4 );
+      for ( int i = 0; i < 20; ++i )
+        assert ( x11 . addStudent ( CStudent ( "Shard Stat" + std::to_string ( i ), CDate ( 1990, 1, 1 ), 2010 ) ) );
+      assert ( x11 . stats () . latency ( EStatOp::ADD ) . count () == 20 );
+    }
+
+    CStudyDept x12;
+    for ( int i = 0; i < 100; ++i )
+      assert ( x12 . addStudent ( CStudent ( i % 10 ? "Bob Plan" + std::to_string ( i ) : "Alice Novak", CDate ( 1990, 1, 1 + i % 28 ), 2000 + i % 10 ) ) );
+    SQueryPlan plan = x12 . explain ( CFilter () . enrolledAfter ( 2007 ), CSort () );
+    assert ( plan . m_Access == "full scan" && ! plan . m_Cached && ! plan . m_SortNeeded && plan . m_Stages . size () == 2 );
+    assert ( plan . m_Stages[0] . m_Estimated == 20 && plan . m_Stages[0] . m_Actual == 20 );
+    assert ( plan . m_Stages[1] . m_Name == "scan" && plan . m_Stages[1] . m_RowsIn == 100 && plan . m_Stages[1] . m_Actual == 20 );
+    plan = x12 . explain ( CFilter () . name ( "novak alice" ), CSort () . addKey ( ESortKey::ENROLL_YEAR, false ) );
+    assert ( plan . m_SortNeeded && plan . m_Stages . size () == 3 && plan . m_Stages[2] . m_Name == "sort" );
+    assert ( plan . m_Stages[0] . m_Estimated == 10 && plan . m_Stages[2] . m_Actual == 10 );
+    plan = x12 . explain ( CFilter (), CSort () . addKey ( ESortKey::NAME, true ) );
+    assert ( plan . m_Access == "name index" && ! plan . m_SortNeeded && plan . m_Stages . back () . m_Actual == 100 );
+    plan = x12 . explain ( CFilter (), CSort () . addKey ( ESortKey::NAME, true ) . addKey ( ESortKey::ENROLL_YEAR, true ) );
+    assert ( plan . m_SortNeeded && plan . m_Stages . back () . m_Name == "sort within equal names" );
+    // a handful of matches is scanned and sorted instead of walking the whole name index
+    plan = x12 . explain ( CFilter () . name ( "bob plan13" ) . name ( "bob plan7" ), CSort () . addKey ( ESortKey::NAME, false ) );
+    assert ( plan . m_Access == "full scan" && plan . m_SortNeeded && plan . m_Stages . back () . m_Name == "sort" );
+    {
+      std::list<CStudent> picked = x12 . search ( CFilter () . name ( "bob plan13" ) . name ( "bob plan7" ) . name ( "alice novak" ),
+                                                  CSort () . addKey ( ESortKey::NAME, false ) . addKey ( ESortKey::ENROLL_YEAR, true ) );
+      std::list<CStudent> walked = x12 . search ( CFilter (), CSort () . addKey ( ESortKey::NAME, false ) . addKey ( ESortKey::ENROLL_YEAR, true ) );
+      walked . remove_if ( [] ( const CStudent & s ) { return s . getName () != "Bob Plan13" && s . getName () != "Bob Plan7" && s . getName () != "Alice Novak"; } );
+      assert ( picked == walked && picked . size () == 12 );
+    }
+    assert ( x12 . search ( CFilter () . enrolledBefore ( 2001 ), CSort () ) . size () == 10 );
+    plan = x12 . explain ( CFilter () . enrolledBefore ( 2001 ), CSort () );
+    assert ( plan . m_Cached && plan . m_Stages[0] . m_Actual == 10 );
+    for ( int i = 0; i < 5; ++i )
+      assert ( x12 . explain ( CFilter (), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) ) . m_Access == "full scan" );
+    for ( int year = 2000; year < 2003; ++year )
+    {
+      std::list<CStudent> res = x12 . search ( CFilter () . enrolledAfter ( year ), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) );
+      assert ( res . size () == size_t ( 2009 - year ) * 10 );
+    }
+    for ( auto deadline = std::chrono::steady_clock::now () + std::chrono::seconds ( 5 );
+          x12 . compositeIndexes () == 0 && std::chrono::steady_clock::now () < deadline; )
+      std::this_thread::yield ();
+    assert ( x12 . compositeIndexes () == 1 );
+    plan = x12 . explain ( CFilter () . enrolledAfter ( 2003 ), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) );
+    assert ( plan . m_Access == "composite index" && ! plan . m_SortNeeded && plan . m_Stages . back () . m_Actual == 60 );
+    // a few matches are sorted rather than picked out of the whole index
+    plan = x12 . explain ( CFilter () . enrolledAfter ( 2008 ), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) );
+    assert ( plan . m_Access == "full scan" && plan . m_SortNeeded && plan . m_Stages . back () . m_Actual == 10 );
+    assert ( x12 . search ( CFilter () . enrolledAfter ( 2008 ), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) )
+             == x12 . search ( CFilter () . enrolledAfter ( 2008 ) . bornAfter ( CDate ( 1900, 1, 1 ) ), CSort () . addKey ( ESortKey::BIRTH_DATE, true ) . addKey ( ESortKey::NAME, false ) ) );
+    x12 . freeze ();
+    plan = x12 . explain ( CFilter () . enrolledAfter ( 2007 ), CSort () . addKey ( ESortKey::NAME, false ) . addKey ( ESortKey::BIRTH_DATE, true ) );
+    assert ( plan . m_Access == "frozen enroll years" && plan . m_SortNeeded && plan . m_Stages . back () . m_Name == "sort" );
+    plan = x12 . explain ( CFilter () . enrolledAfter ( 2002 ), CSort () . addKey ( ESortKey::NAME, false ) . addKey ( ESortKey::BIRTH_DATE, true ) );
+    assert ( plan . m_Access == "name index" && plan . m_Stages . back () . m_Actual == 70 );
+    {
+      // a narrow birth range drives the search and its rows are sorted, with the same result as the name index walk
+      CSort byName = CSort () . addKey ( ESortKey::NAME, true ) . addKey ( ESortKey::ENROLL_YEAR, false );
+      CFilter born = CFilter () . bornAfter ( CDate ( 1990, 1, 26 ) );
+      plan = x12 . explain ( born, byName );
+      assert ( plan . m_Access == "frozen birth dates" && plan . m_Stages[0] . m_Estimated == 6 && plan . m_Stages . back () . m_Name == "sort" );
+      std::list<CStudent> walked = x12 . search ( CFilter (), byName );
+      walked . remove_if ( [] ( const CStudent & s ) { return s . getDateOfBirth () <= CDate ( 1990, 1, 26 ); } );
+      assert ( x12 . search ( born, byName ) == walked && walked . size () == 6 );
+    }
+    {
+      // a wide frozen range still needs its rows sorted, the composite index hands them out in order
+      CSort byBirth = CSort () . addKey ( ESortKey::BIRTH_DATE, true );
+      assert ( x12 . compositeIndexes () == 1 );
+      plan = x12 . explain ( CFilter () . enrolledAfter ( 2001 ), byBirth );
+      assert ( plan . m_Access == "composite index" && ! plan . m_SortNeeded && plan . m_Stages . back () . m_Actual == 80 );
+      plan = x12 . explain ( CFilter () . enrolledAfter ( 2008 ), byBirth );
+      assert ( plan . m_Access == "frozen enroll years" && plan . m_SortNeeded && plan . m_Stages . back () . m_Actual == 10 );
+      std::list<CStudent> walked = x12 . search ( CFilter () . enrolledAfter ( 2001 ), byBirth );
+      assert ( walked . size () == 80 && std::is_sorted ( walked . begin (), walked . end (), [] ( const CStudent & a, const CStudent & b ) {
+        return a . getDateOfBirth () < b . getDateOfBirth ();
+      } ) );
+    }
+    if constexpr ( STUDYDEPT_STATS )
+    {
+      // the path explain reports is the one a search of the same query takes
+      const std::pair<std::string, EStat> paths[] = { { "full scan", EStat::FULL_SCAN }, { "name index", EStat::NAME_INDEX },
+                                                      { "composite index", EStat::COMPOSITE_INDEX },
+                                                      { "frozen birth dates", EStat::FROZEN_INDEX }, { "frozen enroll years", EStat::FROZEN_INDEX } };
+      CSort byBirth = CSort () . addKey ( ESortKey::BIRTH_DATE, true );
+      CSort byName = CSort () . addKey ( ESortKey::NAME, true );
+      const std::pair<CFilter, CSort> queries[] = { { CFilter () . enrolledAfter ( 2001 ) . bornAfter ( CDate ( 1989, 1, 1 ) ), byBirth },
+                                                    { CFilter () . enrolledAfter ( 2009 ), byBirth },
+                                                    { CFilter () . bornAfter ( CDate ( 1990, 1, 27 ) ), byName },
+                                                    { CFilter () . enrolledBefore ( 2009 ), byName },
+                                                    { CFilter () . bornBefore ( CDate ( 1990, 1, 3 ) ) . enrolledAfter ( 2004 ), CSort () },
+                                                    { CFilter () . name ( "bob plan21" ), CSort () } };
+      for ( const auto & [ flt, sortOpt ] : queries )
+      {
+        std::string access = x12 . explain ( flt, sortOpt ) . m_Access;
+        auto path = std::find_if ( std::begin ( paths ), std::end ( paths ), [&] ( const auto & p ) { return p . first == access; } );
+        assert ( path != std::end ( paths ) );
+        uint64_t before = x12 . stats ()[path -> second];
+        std::list<CStudent> found = x12 . search ( flt, sortOpt );
+        assert ( x12 . stats ()[path -> second] == before + 1 );
+      }
+    }
+    plan = x12 . explain ( CFilter () . enrolledAfter ( 2007 ) . bornBefore ( CDate ( 1990, 1, 5 ) ), CSort () );
+    assert ( plan . m_Access == "frozen birth dates" && plan . m_Stages[1] . m_Name == "range lookup" && plan . m_Stages[1] . m_Actual == 16 );
+    assert ( plan . m_Stages[2] . m_RowsIn == 16 && plan . m_Stages[2] . m_Actual == 4 && plan . m_Stages[0] . m_Estimated == 16 );
+    plan = x12 . explain ( CFilter () . enrolledAfter ( 2007 ), CSort () );
+    assert ( plan . m_Access == "frozen enroll years" && plan . m_Stages . back () . m_Actual == 20 );
+    std::ostringstream planText;
+    planText << plan;
+    assert ( planText . str () . starts_with ( "frozen enroll years, index order\n  estimate: in 100, est 20, out 20, " ) );
+    {
+      // explain neither refreshes nor counts: the entry it peeked at is still the one evicted next
+      CStudyDept x15 ( 2 );
+      assert ( x15 . addStudent ( CStudent ( "Peek Only", CDate ( 1990, 1, 1 ), 2010 ) ) );
+      assert ( x15 . search ( CFilter () . enrolledAfter ( 2000 ), CSort () ) . size () == 1 );
+      assert ( x15 . search ( CFilter () . enrolledAfter ( 2001 ), CSort () ) . size () == 1 );
+      SStudyStats before = x15 . stats ();
+      assert ( x15 . explain ( CFilter () . enrolledAfter ( 2000 ), CSort () ) . m_Cached );
+      SStudyStats after = x15 . stats ();
+      assert ( after . latency ( EStatOp::SEARCH ) . count () == before . latency ( EStatOp::SEARCH ) . count () );
+      assert ( after[EStat::SEARCH_CACHE_MISS] == before[EStat::SEARCH_CACHE_MISS] && after[EStat::ROWS_SCANNED] == before[EStat::ROWS_SCANNED] );
+      assert ( x15 . search ( CFilter () . enrolledAfter ( 2002 ), CSort () ) . size () == 1 );
+      assert ( ! x15 . explain ( CFilter () . enrolledAfter ( 2000 ), CSort () ) . m_Cached );
+      assert ( x15 . explain ( CFilter () . enrolledAfter ( 2001 ), CSort () ) . m_Cached );
+    }
+
+    CStudyDept x1 ( 2 );
+    assert ( x1 . addStudent ( CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 ) ) );
+    assert ( x1 . search ( CFilter () . name ( "taylor PETER" ), CSort () ) == (std::list<CStudent>
+            {
+                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
+            }) );
+    assert ( x1 . suggest ( "taylor" ) == (std::set<std::string>
+            {
+                    "Peter Taylor"
+            }) );
+    assert ( x1 . addStudent ( CStudent ( "Taylor Peter", CDate ( 1982, 2, 23), 2011 ) ) );
+    assert ( x1 . search ( CFilter () . name ( "Peter Taylor" ), CSort () . addKey ( ESortKey::NAME, false ) . addKey ( ESortKey::NAME, true ) ) == (std::list<CStudent>
+            {
+                    CStudent ( "Taylor Peter", CDate ( 1982, 2, 23), 2011 ),
+                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
+            }) );
+    assert ( x1 . suggest ( "TAYLOR" ) == (std::set<std::string>
+            {
+                    "Peter Taylor",
+                    "Taylor Peter"
+            }) );
+
+    size_t v1 = x1 . addView ( CFilter () . enrolledAfter ( 2010 ), CSort () . addKey ( ESortKey::NAME, true ) );
+    assert ( x1 . view ( v1 ) . rows () . size () == 2 );
+    assert ( x1 . view ( v1 ) . changes () . empty () );
+    assert ( x1 . addStudent ( CStudent ( "Anna Taylor", CDate ( 1990, 1, 1), 2015 ) ) );
+    assert ( x1 . addStudent ( CStudent ( "Old Taylor", CDate ( 1950, 1, 1), 1970 ) ) );
+    assert ( x1 . delStudent ( CStudent ( "Taylor Peter", CDate ( 1982, 2, 23), 2011 ) ) );
+    CStudyView v1Copy = x1 . view ( v1 );
+    assert ( std::list<CStudent> ( v1Copy . rows () . begin (), v1Copy . rows () . end () ) == (std::list<CStudent>
+            {
+                    CStudent ( "Anna Taylor", CDate ( 1990, 1, 1), 2015 ),
+                    CStudent ( "Peter Taylor", CDate ( 1982, 2, 23), 2011 )
+            }) );
+    assert ( v1Copy . changes () . size () == 2 && x1 . view ( v1 ) . changes () . size () == 2 );
+    auto v1Changes = x1 . takeChanges ( v1 );
+    assert ( v1Changes . size () == 2 );
+    assert ( v1Changes[0] . m_Added && v1Changes[0] . m_Student == CStudent ( "Anna Taylor", CDate ( 1990, 1, 1), 2015 ) );
+    assert ( ! v1Changes[1] . m_Added && v1Changes[1] . m_Student == CStudent ( "Taylor Peter", CDate ( 1982, 2, 23), 2011 ) );
+    assert ( x1 . view ( v1 ) . changes () . empty () && x1 . takeChanges ( v1 ) . empty () );
+    assert ( x1 . dropView ( v1 ) );
+    assert ( ! x1 . dropView ( v1 ) );
+    {
+      // the change log keeps the newest changes nobody took, a reader polls next to a writer
+      CStudyDept x18;
+      size_t capped = x18 . addView ( CFilter () . name ( "capped" ), CSort (), 4 );
+      std::thread writer ( [&x18] {
+        for ( int i = 0; i < 200; i ++ )
+        {
+          bool ok = x18 . addStudent ( CStudent ( "Capped", CDate ( 1990, 1, 1 + i % 28 ), 2000 + i ) );
+          assert ( ok );
+        }
+      } );
+      for ( int i = 0; i < 200; i ++ )
+      {
+        CStudyView copy = x18 . view ( capped );
+        assert ( copy . rows () . size () >= copy . changes () . size () && copy . changes () . size () <= 4 );
+      }
+      writer . join ();
+      std::vector<SViewChange> last = x18 . takeChanges ( capped );
+      assert ( last . size () == 4 && x18 . view ( capped ) . lost () == 196 && x18 . view ( capped ) . rows () . size () == 200 );
+      assert ( last . back () . m_Student == CStudent ( "Capped", CDate ( 1990, 1, 1 + 199 % 28 ), 2199 ) );
+    }
+
+    std::pmr::monotonic_buffer_resource arena;
+    CStudyDept x2 ( 0, &arena );
+    for ( int i = 0; i < 2000; i ++ )
+      assert ( x2 . addStudent ( CStudent ( "Student Number " + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 10 ) ) );
+    for ( int i = 0; i < 2000; i ++ )
+      assert ( i % 4 == 3 || x2 . delStudent ( CStudent ( "Student Number " + std::to_string ( i ), CDate ( 1990, 1, 1 + i % 28 ), 2010 + i % 10 ) ) );
+    assert ( x2 . count ( CFilter () ) == 500 );
+    assert ( x2 . search ( CFilter () . name ( "number student 1999" ), CSort () ) == (std::list<CStudent>
+            {
+                    CStudent ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 )
+            }) );
+    assert ( x2 . suggest ( "1998" ) . empty () );
+    assert ( x2 . contains ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 ) );
+    assert ( ! x2 . contains ( "Student Number 1998", CDate ( 1990, 1, 1 + 1998 % 28 ), 2018 ) );
+    assert ( ! x2 . contains ( CStudent ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2018 ) ) );
+    assert ( x2 . delStudent ( std::string_view ( "Student Number 1999" ), CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 ) );
+    assert ( ! x2 . delStudent ( std::string_view ( "Student Number 1999" ), CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 ) );
+    assert ( x2 . emplaceStudent ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 ) );
+    assert ( ! x2 . emplaceStudent ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 ) );
+    CStudent moved ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 );
+    assert ( ! x2 . addStudent ( std::move ( moved ) ) );
+    x2 . compact ();
+    assert ( x2 . tombstones () == 0 );
+    assert ( x2 . count ( CFilter () ) == 500 );
+    assert ( x2 . search ( CFilter () . enrolledAfter ( 2018 ), CSort () . addKey ( ESortKey::NAME, false ) ) . front () == CStudent ( "Student Number 999", CDate ( 1990, 1, 1 + 999 % 28 ), 2019 ) );
+    size_t v2 = x2 . addView ( CFilter () . enrolledAfter ( 2018 ) . name ( "student number 999" ) . name ( "student number 1999" ), CSort () . addKey ( ESortKey::NAME, true ) );
+    assert ( x2 . view ( v2 ) . rows () . size () == 2 );
+    x2 . clear ();
+    assert ( x2 . count ( CFilter () ) == 0 );
+    assert ( x2 . view ( v2 ) . rows () . empty () );
+    auto v2Changes = x2 . takeChanges ( v2 );
+    assert ( v2Changes . size () == 2 && ! v2Changes[0] . m_Added && ! v2Changes[1] . m_Added );
+    assert ( v2Changes[0] . m_Student == CStudent ( "Student Number 1999", CDate ( 1990, 1, 1 + 1999 % 28 ), 2019 ) );
+    assert ( x2 . addStudent ( CStudent ( "James Bond", CDate ( 1981, 7, 16), 2013 ) ) );
+    assert ( x2 . addStudent ( CStudent ( "Student Number 999", CDate ( 1990, 1, 1 + 999 % 28 ), 2019 ) ) );
+    assert ( x2 . view ( v2 ) . rows () . size () == 1 && x2 . view ( v2 ) . changes () . size () == 1 );
+    assert ( x2 . dropView ( v2 ) );
+    assert ( x2 . suggest ( "bond" ) == (std::set<std::string>
+            {
+                    "James Bond"
+            }) );
+    {
+      // one common name and one intake year: the birth date alone tells the students apart, in the hash too
+      CStudyDept x16;
+      for ( int i = 0; i < 20000; i ++ )
+        assert ( x16 . addStudent ( CStudent ( "Jan Novak", CDate ( 1950 + i / 336, 1 + i / 28 % 12, 1 + i % 28 ), 2020 ) ) );
+      assert ( ! x16 . addStudent ( CStudent ( "Jan Novak", CDate ( 1950, 1, 1 ), 2020 ) ) );
+      for ( int i = 0; i < 20000; i += 2 )
+        assert ( x16 . delStudent ( CStudent ( "Jan Novak", CDate ( 1950 + i / 336, 1 + i / 28 % 12, 1 + i % 28 ), 2020 ) ) );
+      assert ( x16 . count ( CFilter () ) == 10000 && x16 . contains ( CStudent ( "Jan Novak", CDate ( 1950, 1, 2 ), 2020 ) ) );
+      assert ( ! x16 . contains ( CStudent ( "Jan Novak", CDate ( 1950, 1, 1 ), 2020 ) ) );
+    }
     return EXIT_SUCCESS;
 }
-#endif /* __PROGTEST__ */
+#endif /* __PROGTEST__, STUDYDEPT_BENCHMARK */